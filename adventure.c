@@ -35,12 +35,9 @@
  *        Cleaned up code for distribution.
  */
 
-#include <errno.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <time.h>
 
 #include "assert.h"
@@ -50,6 +47,10 @@
 #include "text.h"
 #include "world.h"
 
+#ifdef SCROLL_BENCHMARK_PROGRAM
+#include "bench.h"
+#endif
+
 
 /*
  * If NDEBUG is not defined, we execute sanity checks to make sure that
@@ -64,16 +65,15 @@ static int sanity_check(void);
 
 /* a few constants */
 #define TICK_USEC      50000 /* tick length in microseconds          */
+#define TICK_NSEC      (TICK_USEC * 1000L) /* tick length in nanoseconds */
 #define STATUS_MSG_LEN 40    /* maximum length of status message     */
+#define STATUS_MSG_NSEC 1500000000L /* time a status message is shown */
 #define MOTION_SPEED   2     /* pixels moved per command             */
-#define time1000000 1000000 //time
 /* outcome of the game */
 typedef enum {GAME_WON, GAME_QUIT} game_condition_t;
 
 int32_t enter_room;
 
-game_condition_t game;
-
 /* structure used to hold game information */
 typedef struct {
     room_t*      where;          /* current room for player               */
@@ -83,6 +83,35 @@ typedef struct {
 } game_info_t;
 
 
+/*
+ * Event loop tick scheduling.  The next field holds the absolute time of
+ * the next tick on CLOCK_MONOTONIC, which the game loop gives to
+ * wait_for_input as its deadline whenever something must happen on
+ * ticks.  Ticks that pass completely while the loop is busy are skipped
+ * (not run late), and are counted in missed; ticks that pass while the
+ * loop sleeps without a deadline are skipped but not missed.  ticks
+ * counts all ticks since tick_start.
+ */
+typedef struct {
+    struct timespec next;       /* time of next tick                    */
+    unsigned long   ticks;      /* ticks passed since start             */
+    unsigned long   missed;     /* ticks skipped since start            */
+} tick_sched_t;
+
+
+/*
+ * Status message record.  show_status writes a message and the time at
+ * which it expires(on CLOCK_MONOTONIC); the game loop shows the message
+ * until that time passes, and then simply stops showing it.  Both run
+ * on the game loop's thread(the only thread), so the record needs no
+ * lock.
+ */
+typedef struct {
+    struct timespec expires;                 /* time to stop showing it */
+    char            text[STATUS_MSG_LEN + 1];
+} status_msg_t;
+
+
 /*
  * enumerated values, structure, and static data used for parsing typed
  * commands
@@ -137,8 +166,10 @@ static const typed_cmd_t cmd_list[] = {
 
 /* local functions--see function headers for details */
 
-static void cancel_status_thread(void* ignore);
 static game_condition_t game_loop(void);
+static int next_command(cmd_event_t* ev);
+static int get_status_msg(char* buf, struct timespec* expires,
+                          const struct timespec* now);
 static int32_t handle_typing(void);
 static void init_game(void);
 static void move_photo_down(void);
@@ -146,59 +177,103 @@ static void move_photo_left(void);
 static void move_photo_right(void);
 static void move_photo_up(void);
 static void redraw_room(void);
-static void* status_thread(void* ignore);
-static int time_is_after(struct timeval* t1, struct timeval* t2);
-static void* tux_thread (void* ignore);
-static void cancel_tux_thread(void* ignore);
+static void tick_start(tick_sched_t* sched);
+static unsigned long tick_advance(tick_sched_t* sched, int waited);
+static int time_is_after(const struct timespec* t1, const struct timespec* t2);
 
 /* file-scope variables */
 
 static game_info_t game_info; /* game information */
 static int prev_time = 0;
+static tick_sched_t game_ticks;  /* ticks of game_loop  */
 
 
 /*
- * The variables below are used to keep track of the status message helper
- * thread, with Posix thread id recorded in status_thread_id.
- *
- * The status_msg records the current status message: when the
- * string recorded there is empty, no status message need be displayed, and
- * the status bar should instead reflect the name of the current room and the
- * player's typing(for typed commands).
- *
- * The status_msg is protected by the msg_lock mutex, which should be
- * acquired before reading or writing the message.  Further, if the message
- * is changed, the helper thread must be notified by signaling it with the
- * condition variable msg_cv(while holding the msg_lock).
+ * The status_msg records the current status message: when the message
+ * is empty or has expired, no status message need be displayed, and the
+ * status bar should instead reflect the name of the current room and the
+ * player's typing(for typed commands).  Read it only with
+ * get_status_msg, and write it only with show_status.
  */
-static pthread_t status_thread_id;
-static pthread_t tux_thread_id;
-static pthread_mutex_t msg_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  msg_cv = PTHREAD_COND_INITIALIZER;
-static char status_msg[STATUS_MSG_LEN + 1] = { '\0' };
-
-extern void write_user_input(const char* msg); 
-extern void write_status_message(const char* msg);
-extern void clear_status_bar(); 
-extern void write_room_name(const char* msg);
+static status_msg_t status_msg;
+
 /*
- * cancel_status_thread
- *   DESCRIPTION: Terminates the status message helper thread.  Used as
- *                a cleanup method to ensure proper shutdown.
- *   INPUTS: none(ignored)
- *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ * Commands from the keyboard and from the Tux controller.  The input
+ * code pushes each command into its device's ring as soon as it is read
+ * (see wait_for_input); only the game loop pops them and acts on them,
+ * so only the game loop changes the game state and draws.
  */
-static void cancel_status_thread(void* ignore) {
-    (void)pthread_cancel(status_thread_id);
+static cmd_ring_t kbd_cmds;
+static cmd_ring_t tux_cmds;
+
+
+#ifdef SCROLL_BENCHMARK_PROGRAM
+
+/*
+ * The scroll benchmark times the mode X calls made by the move_photo_*
+ * functions(and by the benchmark itself) by routing them through the
+ * wrappers below.  Each wrapper adds its time to the current frame of
+ * the corresponding benchmark stage.
+ */
+#define BENCH_PASSES     20     /* sweeps across the photo per speed */
+#define BENCH_MAX_FRAMES 100000 /* samples kept per stage            */
+#define BENCH_IDLE_FRAMES 1000  /* frames shown without moving       */
+
+static bench_stage_t bench_view;    /* set_view_window                   */
+static bench_stage_t bench_draw;    /* draw_horiz_line(s), draw_vert_line(s) */
+static bench_stage_t bench_show;    /* show_screen                       */
+static bench_stage_t bench_frame;   /* whole frame                       */
+static bench_stage_t bench_idle;    /* show_screen with nothing changed  */
+
+static void bench_set_view_window(int scr_x, int scr_y) {
+    uint64_t start = bench_now_ns();
+    set_view_window(scr_x, scr_y);
+    bench_stage_add(&bench_view, bench_now_ns() - start);
+}
+
+static int bench_draw_horiz_line(int y) {
+    uint64_t start = bench_now_ns();
+    int ret_val = draw_horiz_line(y);
+    bench_stage_add(&bench_draw, bench_now_ns() - start);
+    return ret_val;
+}
+
+static int bench_draw_vert_line(int x) {
+    uint64_t start = bench_now_ns();
+    int ret_val = draw_vert_line(x);
+    bench_stage_add(&bench_draw, bench_now_ns() - start);
+    return ret_val;
+}
+
+static int bench_draw_horiz_lines(int y0, int n) {
+    uint64_t start = bench_now_ns();
+    int ret_val = draw_horiz_lines(y0, n);
+    bench_stage_add(&bench_draw, bench_now_ns() - start);
+    return ret_val;
+}
+
+static int bench_draw_vert_lines(int x0, int n) {
+    uint64_t start = bench_now_ns();
+    int ret_val = draw_vert_lines(x0, n);
+    bench_stage_add(&bench_draw, bench_now_ns() - start);
+    return ret_val;
 }
 
-static void cancel_tux_thread (void* ignore) {
-    (void)pthread_cancel (tux_thread_id);
+static void bench_show_screen() {
+    uint64_t start = bench_now_ns();
+    show_screen();
+    bench_stage_add(&bench_show, bench_now_ns() - start);
 }
 
+#define set_view_window bench_set_view_window
+#define draw_horiz_line bench_draw_horiz_line
+#define draw_vert_line  bench_draw_vert_line
+#define draw_horiz_lines bench_draw_horiz_lines
+#define draw_vert_lines  bench_draw_vert_lines
+#define show_screen     bench_show_screen
+
+#endif /* SCROLL_BENCHMARK_PROGRAM */
+
 
 /*
  * game_loop
@@ -215,21 +290,18 @@ static game_condition_t game_loop() {
      * Variables used to carry information between event loop ticks; see
      * initialization below for explanations of purpose.
      */
-    struct timeval start_time, tick_time;
-
-    struct timeval cur_time; /* current time(during tick)      */
-    cmd_t cmd;               /* command issued by input control */
+    cmd_event_t ev;          /* command issued by input control */
     int time_cur;
-
-    /* Record the starting time--assume success. */
-    (void)gettimeofday(&start_time, NULL);
+    int msg_showing;         /* 1 if a status message is shown  */
+    int ticking;             /* 1 if waiting for the next tick  */
+    char msg[STATUS_MSG_LEN + 1];  /* status message shown     */
+    struct timespec msg_expires;   /* time to stop showing msg */
+    struct timespec now;           /* time of this frame       */
+    const char* cmd;               /* typed command shown      */
+    const struct timespec* deadline;  /* time to stop waiting  */
 
     /* Calculate the time at which the first event loop tick should occur. */
-    tick_time = start_time;
-    if ((tick_time.tv_usec += TICK_USEC) > 1000000) {
-        tick_time.tv_sec++;
-        tick_time.tv_usec -= 1000000;
-    }
+    tick_start(&game_ticks);
 
     /* The player has just entered the first room. */
     enter_room = 1;
@@ -259,125 +331,120 @@ static game_condition_t game_loop() {
             /* Only draw once on entry. */
             enter_room = 0;
 
-            /* Draw the empty status bar */ 
-            clear_status_bar();
+            /* Draw the whole status bar again. */
+            status_bar_invalidate();
         }
 
-        pthread_mutex_lock(&msg_lock); 
-
-            /* Check status message */    
-            if(status_msg[0]) {
-                // draw_status_bar(status_msg, STATUS_MSG);  
-                write_status_message(status_msg);  
-            }
-            else {
-
-                /* Clear the status bar */ 
-                // draw_status_bar(" ", CLEAR);
-                clear_status_bar();
-
-                /* Display the room name */ 
-                //draw_status_bar(room_name (game_info.where), ROOM_NAME);
-                write_room_name(room_name (game_info.where));
-
-                /* Display the command */ 
-                char *cmd = (char *)get_typed_command();
-				
-                /* Draw the user input starting from the right side of the screen */ 
-                while (' ' == *cmd) { cmd++; } // if there's a whitespace, increment the cmd ptr
-                if ('\0' != *cmd) {
-                    write_user_input(cmd);
-                }
-                else {
-                    write_user_input(chara);
-                }
-            }
-        pthread_mutex_unlock(&msg_lock); 
-
-
-        show_screen();
-
         /*
-         * Wait for tick.  The tick defines the basic timing of our
-         * event loop, and is the minimum amount of time between events.
+         * Show the status message if there is one, and otherwise the room
+         * name and the typed command(or a cursor if nothing is typed).
+         * draw_status_bar draws and copies only what has changed.
          */
-        do {
-            if (gettimeofday(&cur_time, NULL) != 0) {
-                /* Panic!(should never happen) */
-                clear_mode_X();
-                shutdown_input();
-                perror("gettimeofday");
-                exit(3);
-            }
-        } while (!time_is_after(&cur_time, &tick_time));
+        (void)clock_gettime(CLOCK_MONOTONIC, &now);
+        msg_showing = get_status_msg(msg, &msg_expires, &now);
+        cmd = get_typed_command();
+        while (' ' == *cmd) { cmd++; } // if there's a whitespace, increment the cmd ptr
+        draw_status_bar((msg_showing ? msg : NULL), room_name(game_info.where),
+                        ('\0' != *cmd ? cmd : chara));
+
+        show_screen();
 
         /*
-         * Advance the tick time.  If we missed one or more ticks completely,
-         * i.e., if the current time is already after the time for the next
-         * tick, just skip the extra ticks and advance the clock to the one
-         * that we haven't missed.
+         * Wait for input, for the next tick if an input device must be
+         * polled(see input_needs_ticks), or for the status message to
+         * expire, whichever comes first.  With none of those, sleep until
+         * input arrives.  Commands left over from a change of room are
+         * handled without waiting.
          */
-        do {
-            if ((tick_time.tv_usec += TICK_USEC) > 1000000) {
-                tick_time.tv_sec++;
-                tick_time.tv_usec -= 1000000;
-            }
-        } while (time_is_after(&cur_time, &tick_time));
+        ticking = input_needs_ticks();
+        deadline = (ticking ? &game_ticks.next : NULL);
+        if (msg_showing &&
+            (NULL == deadline || time_is_after(deadline, &msg_expires))) {
+            deadline = &msg_expires;
+        }
+        if (!cmd_ring_peek(&kbd_cmds, &ev) && !cmd_ring_peek(&tux_cmds, &ev) &&
+            -1 == wait_for_input(&kbd_cmds, &tux_cmds, deadline)) {
+            /* Panic!(should never happen) */
+            clear_mode_X();
+            shutdown_input();
+            perror("wait_for_input");
+            exit(3);
+        }
 
         /*
          * Handle asynchronous events.  These events use real time rather
          * than tick counts for timing, although the real time is rounded
-         * off to the nearest tick by definition.
+         * off to the nearest tick by definition.  The tick defines the
+         * basic timing of our event loop, and is the minimum amount of
+         * time between polls of the input devices.
          */
-        /*(none right now...) */
-        time_cur = tick_time.tv_sec - start_time.tv_sec;
-		if(time_cur != prev_time)
-		{
-			//display_time_on_tux(time_cur);
-			display_time_on_tux(time_cur);
- 	    	prev_time = time_cur;
-		}
+        if (0 != tick_advance(&game_ticks, ticking)) {
+            (void)poll_input(&tux_cmds);
+            time_cur = game_ticks.ticks / (1000000 / TICK_USEC);
+            if (time_cur != prev_time) {
+                display_time_on_tux(time_cur);
+                prev_time = time_cur;
+            }
+        }
 
         /*
-         * Handle synchronous events--in this case, only player commands.
-         * Note that typed commands that move objects may cause the room
-         * to be redrawn.
+         * Handle synchronous events--in this case, only player commands,
+         * in the order in which they were read.  Note that typed commands
+         * that move objects may cause the room to be redrawn.  Commands
+         * after a change of room wait until the new room has been drawn.
          */
+        while (!enter_room && next_command(&ev)) {
+            switch (ev.cmd) {
+                case CMD_UP:    move_photo_down();  break;
+                case CMD_RIGHT: move_photo_left();  break;
+                case CMD_DOWN:  move_photo_up();    break;
+                case CMD_LEFT:  move_photo_right(); break;
+                case CMD_MOVE_LEFT:
+                    enter_room = (TC_CHANGE_ROOM == try_to_move_left(&game_info.where));
+                    break;
+                case CMD_ENTER:
+                    enter_room = (TC_CHANGE_ROOM == try_to_enter(&game_info.where));
+                    break;
+                case CMD_MOVE_RIGHT:
+                    enter_room = (TC_CHANGE_ROOM == try_to_move_right(&game_info.where));
+                    break;
+                case CMD_TYPED:
+                    if (handle_typing()) {
+                        enter_room = 1;
+                    }
+                    break;
+                case CMD_QUIT: return GAME_QUIT;
+                default: break;
+            }
 
-		pthread_mutex_lock (&cmd_lock);
-        cmd = get_command();
-        switch (cmd) {
-            case CMD_UP:    move_photo_down();  break;
-            case CMD_RIGHT: move_photo_left();  break;
-            case CMD_DOWN:  move_photo_up();    break;
-            case CMD_LEFT:  move_photo_right(); break;
-            case CMD_MOVE_LEFT:
-                enter_room = (TC_CHANGE_ROOM == try_to_move_left(&game_info.where));
-                break;
-            case CMD_ENTER:
-                enter_room = (TC_CHANGE_ROOM == try_to_enter(&game_info.where));
-                break;
-            case CMD_MOVE_RIGHT:
-                enter_room = (TC_CHANGE_ROOM == try_to_move_right(&game_info.where));
-                break;
-            case CMD_TYPED:
-                if (handle_typing()) {
-                    enter_room = 1;
-                }
-                break;
-            case CMD_QUIT: return GAME_QUIT;
-            default: break;
-        }
-        pthread_mutex_unlock (&cmd_lock);
-
-        /* If player wins the game, their room becomes NULL. */
-        if (NULL == game_info.where) {
-            return GAME_WON;
+            /* If player wins the game, their room becomes NULL. */
+            if (NULL == game_info.where) {
+                return GAME_WON;
+            }
         }
     } /* end of the main event loop */
 }
 
 
+/*
+ * next_command
+ *   DESCRIPTION: Get the oldest command read from either input device.
+ *   INPUTS: none(reads the keyboard and Tux command rings)
+ *   OUTPUTS: ev -- the command and the time at which it was read
+ *   RETURN VALUE: 1 if a command was found, 0 if both rings are empty
+ *   SIDE EFFECTS: removes the command from its ring
+ */
+static int next_command(cmd_event_t* ev) {
+    cmd_event_t tux_ev;     /* oldest command from the Tux controller */
+
+    if (!cmd_ring_peek(&tux_cmds, &tux_ev))
+        return cmd_ring_pop(&kbd_cmds, ev);
+    if (cmd_ring_peek(&kbd_cmds, ev) && !time_is_after(&ev->time, &tux_ev.time))
+        return cmd_ring_pop(&kbd_cmds, ev);
+    return cmd_ring_pop(&tux_cmds, ev);
+}
+
+
 /*
  * handle_typing
  *   DESCRIPTION: Parse and execute a typed command.
@@ -529,7 +596,6 @@ static void init_game() {
  */
 static void move_photo_down() {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
     delta = (game_info.y_speed > game_info.map_y ? game_info.map_y : game_info.y_speed);
@@ -539,9 +605,7 @@ static void move_photo_down() {
     set_view_window(game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-        (void)draw_horiz_line(idx);
-    }
+    (void)draw_horiz_lines(0, delta);
 }
 
 
@@ -557,7 +621,6 @@ static void move_photo_down() {
  */
 static void move_photo_left() {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
 
     /* Calculate the number of pixels by which to move. */
     delta = room_photo_width(game_info.where) - SCROLL_X_DIM - game_info.map_x;
@@ -568,9 +631,7 @@ static void move_photo_left() {
     set_view_window(game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-        (void)draw_vert_line(SCROLL_X_DIM - idx);
-    }
+    (void)draw_vert_lines(SCROLL_X_DIM - delta, delta);
 }
 
 
@@ -586,7 +647,6 @@ static void move_photo_left() {
  */
 static void move_photo_right() {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
 
     /* Calculate the number of pixels by which to move. */
     delta = (game_info.x_speed > game_info.map_x ? game_info.map_x : game_info.x_speed);
@@ -596,9 +656,7 @@ static void move_photo_right() {
     set_view_window(game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-        (void)draw_vert_line(idx);
-    }
+    (void)draw_vert_lines(0, delta);
 }
 
 
@@ -614,7 +672,6 @@ static void move_photo_right() {
  */
 static void move_photo_up() {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
     delta = room_photo_height(game_info.where) - SCROLL_Y_DIM - game_info.map_y;
@@ -625,9 +682,7 @@ static void move_photo_up() {
     set_view_window(game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-        (void)draw_horiz_line(SCROLL_Y_DIM - idx);
-    }
+    (void)draw_horiz_lines(SCROLL_Y_DIM - delta, delta);
 }
 
 
@@ -640,162 +695,66 @@ static void move_photo_up() {
  *   SIDE EFFECTS: Draws the entire screen(but not the status bar).
  */
 static void redraw_room() {
-    int32_t i; /* index over rows */
-
     /* Draw all lines in the scroll region. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) {
-        (void)draw_horiz_line(i);
-    }
+    (void)draw_horiz_lines(0, SCROLL_Y_DIM);
 }
 
 
 /*
- * status_thread
- *   DESCRIPTION: Function executed by status message helper thread.
- *                Waits for a message to be displayed, then shows the
- *                message for 1.5 seconds before deleting it.  If a
- *                new message has appeared in the meantime, restarts the
- *                clock and tries again.
- *   INPUTS: none(ignored)
+ * tick_start
+ *   DESCRIPTION: Start scheduling the ticks of an event loop, with the
+ *                first tick one tick length from now.
+ *   INPUTS: sched -- the tick schedule
  *   OUTPUTS: none
- *   RETURN VALUE: NULL
- *   SIDE EFFECTS: Changes the status message to an empty string.
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: resets the tick and missed tick counts
  */
-static void* status_thread(void* ignore) {
-    struct timespec ts; /* absolute wake-up time */
-
-    while (1) {
-        /*
-         * Wait for a message to appear.  Note that we must check the
-         * condition after acquiring the lock, and that pthread_cond_wait
-         * yields the lock, then reacquires the lock before returning.
-         */
-        (void)pthread_mutex_lock(&msg_lock);
-        while ('\0' == status_msg[0]) {
-            pthread_cond_wait(&msg_cv, &msg_lock);
-        }
-
-        /*
-         * A message is present: if we stop before the timeout
-         * passes, assume that a new one has been posted; if the
-         * timeout passes, clear the message and wait for a new one.
-         */
-        do {
-            /* Get the current time. */
-            clock_gettime(CLOCK_REALTIME, &ts);
-
-            /* Add 1.5 seconds to it. */
-            if (500000000 <= ts.tv_nsec) {
-                ts.tv_sec += 2;
-                ts.tv_nsec -= 500000000;
-            }
-else {
-                ts.tv_sec += 1;
-                ts.tv_nsec += 500000000;
-            }
-
-            /*
-             * And go to sleep.  If we wake up due to anything but a
-             * timeout, we assume(possibly incorrectly) that a new
-             * message has appeared and try to wait 1.5 seconds again.
-             */
-        } while (ETIMEDOUT != pthread_cond_timedwait(&msg_cv, &msg_lock, &ts));
-
-        /*
-         * Clear the message, then release the lock(remember that
-         * pthread_cond_timedwait reacquires the lock before returning).
-         */
-        status_msg[0] = '\0';
-        (void)pthread_mutex_unlock(&msg_lock);
+static void tick_start(tick_sched_t* sched) {
+    /* Assume success(CLOCK_MONOTONIC is always supported). */
+    (void)clock_gettime(CLOCK_MONOTONIC, &sched->next);
+    if ((sched->next.tv_nsec += TICK_NSEC) >= 1000000000L) {
+        sched->next.tv_sec++;
+        sched->next.tv_nsec -= 1000000000L;
     }
-
-    /* This code never executes--the thread should always be cancelled. */
-    return NULL;
+    sched->ticks = 0;
+    sched->missed = 0;
 }
 
-static void* tux_thread (void* ignore) {
-	cmd_t cmd; //different cmds
-	struct timeval start_time, tick_time;
-
-    struct timeval cur_time; // current time (during tick)
 
-
-    //the starting time
-    (void)gettimeofday (&start_time, NULL);
-
-    tick_time = start_time;
-    if ((tick_time.tv_usec += TICK_USEC) > time1000000) {//calculate the time
-	tick_time.tv_sec++;
-	tick_time.tv_usec -= time1000000;
+/*
+ * tick_advance
+ *   DESCRIPTION: If the time for the next tick of an event loop has come,
+ *                advance the schedule.  If we missed one or more ticks
+ *                completely, i.e., if the current time is already after
+ *                the time for the next tick, just skip the extra ticks and
+ *                advance the clock to the one that we haven't missed.
+ *   INPUTS: sched -- the tick schedule
+ *           waited -- 1 if the caller waited for the tick, so skipped
+ *                     ticks were missed; 0 if it slept without a deadline
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of ticks that have passed(0 if the time for
+ *                 the next tick has not come)
+ *   SIDE EFFECTS: may add to the missed tick count
+ */
+static unsigned long tick_advance(tick_sched_t* sched, int waited) {
+    struct timespec cur_time;   /* current time        */
+    unsigned long passed;       /* ticks that passed   */
+
+    /* Assume success(CLOCK_MONOTONIC is always supported). */
+    (void)clock_gettime(CLOCK_MONOTONIC, &cur_time);
+    for (passed = 0; time_is_after(&cur_time, &sched->next); passed++) {
+        if ((sched->next.tv_nsec += TICK_NSEC) >= 1000000000L) {
+            sched->next.tv_sec++;
+            sched->next.tv_nsec -= 1000000000L;
+        }
     }
-
-	while(1)
-	{
-		(void)pthread_mutex_lock (&cmd_lock);
-    
-    cmd = get_tux_command();
-	switch (cmd) //implement different cmds
-	{
-	    case CMD_RIGHT: move_photo_left ();  break;
-	    case CMD_LEFT:  move_photo_right (); break;
-        case CMD_DOWN:  move_photo_up ();    break;
-        case CMD_UP:    move_photo_down ();  break;
-	    case CMD_MOVE_LEFT:   
-		enter_room = (TC_CHANGE_ROOM == try_to_move_left (&game_info.where));
-		break;
-	    case CMD_ENTER:
-		enter_room = (TC_CHANGE_ROOM ==try_to_enter (&game_info.where));
-		break;
-	    case CMD_MOVE_RIGHT:
-		enter_room = (TC_CHANGE_ROOM == try_to_move_right (&game_info.where));
-		break;
-		case CMD_QUIT: 
-			game = GAME_QUIT; 
-            break;
-	    default: break;
-	}
-
-    (void)pthread_mutex_unlock (&cmd_lock);
-	/* If player wins the game, their room becomes NULL. */
-	if (NULL == game_info.where) {
-	    game = GAME_WON;
-	}
-
-
-	/*
-	 * Wait for tick.  The tick defines the basic timing of our
-	 * event loop, and is the minimum amount of time between events.
-	 */
-	do {
-	    if (gettimeofday (&cur_time, NULL) != 0) 
-		{
-		/* Panic!  (should never happen) */
-		clear_mode_X ();
-		shutdown_input ();
-		perror ("gettimeofday");
-		exit (3);
-	    }
-	} while (!time_is_after (&cur_time, &tick_time));
-
-	/*
-	 * Advance the tick time.  If we missed one or more ticks completely, 
-	 * i.e., if the current time is already after the time for the next 
-	 * tick, just skip the extra ticks and advance the clock to the one
-	 * that we haven't missed.
-	 */
-	do {
-	    if ((tick_time.tv_usec += TICK_USEC) > time1000000) 
-		{
-		tick_time.tv_sec++;
-		tick_time.tv_usec -= time1000000;
-	    }
-	} while (time_is_after (&cur_time, &tick_time));
-	}
-	
-	
-	return NULL;
+    sched->ticks += passed;
+    if (waited && 1 < passed)
+        sched->missed += passed - 1;
+    return passed;
 }
 
+
 /*
  * time_is_after
  *   DESCRIPTION: Check whether one time is at or after a second time.
@@ -806,42 +765,207 @@ static void* tux_thread (void* ignore) {
  *                 0 if t1 < t2
  *   SIDE EFFECTS: none
  */
-static int time_is_after(struct timeval* t1, struct timeval* t2) {
+static int time_is_after(const struct timespec* t1, const struct timespec* t2) {
     if (t1->tv_sec == t2->tv_sec)
-        return (t1->tv_usec >= t2->tv_usec);
+        return (t1->tv_nsec >= t2->tv_nsec);
     if (t1->tv_sec > t2->tv_sec)
         return 1;
     return 0;
 }
 
 
+/*
+ * get_status_msg
+ *   DESCRIPTION: Copy the current status message, if it has not yet
+ *                expired.
+ *   INPUTS: now -- the current time(CLOCK_MONOTONIC)
+ *   OUTPUTS: buf -- the message(STATUS_MSG_LEN + 1 bytes)
+ *            expires -- the time at which the message expires
+ *   RETURN VALUE: 1 if a message should be shown, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int get_status_msg(char* buf, struct timespec* expires,
+                          const struct timespec* now) {
+    memcpy(buf, status_msg.text, STATUS_MSG_LEN + 1);
+    *expires = status_msg.expires;
+    return ('\0' != buf[0] && !time_is_after(now, expires));
+}
+
+
 /*
  * show_status(interface function; declared in world.h)
  *   DESCRIPTION: Show a specific status message of up to STATUS_MSG_LEN
- *                characters.
+ *                characters for 1.5 seconds.  Must be called only from
+ *                the game loop's thread.
  *   INPUTS: s -- the string used for the status message
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Overwrites any previous message.
+ *   SIDE EFFECTS: Overwrites any previous message, restarting the clock.
  */
 void show_status(const char* s) {
-    /* msg_lock critical section starts here. */
-    (void)pthread_mutex_lock(&msg_lock);
+    struct timespec expires;   /* time to stop showing the message */
+
+    /* Assume success(CLOCK_MONOTONIC is always supported). */
+    (void)clock_gettime(CLOCK_MONOTONIC, &expires);
+    expires.tv_sec += STATUS_MSG_NSEC / 1000000000L;
+    if ((expires.tv_nsec += STATUS_MSG_NSEC % 1000000000L) >= 1000000000L) {
+        expires.tv_sec++;
+        expires.tv_nsec -= 1000000000L;
+    }
 
-    /* Copy the new message under the protection of msg_lock. */
-    strncpy(status_msg, s, STATUS_MSG_LEN);
-    status_msg[STATUS_MSG_LEN] = '\0';
+    strncpy(status_msg.text, s, STATUS_MSG_LEN);
+    status_msg.text[STATUS_MSG_LEN] = '\0';
+    status_msg.expires = expires;
+}
 
-    /*
-     * Wake up the status message helper thread.  Note that we still hold
-     * the msg_lock, so the thread can't wake up until we release it.
-     */
-    (void)pthread_cond_signal(&msg_cv);
 
-    /* msg_lock critical section ends here. */
-    (void)pthread_mutex_unlock(&msg_lock);
+#ifdef SCROLL_BENCHMARK_PROGRAM
+
+/*
+ * bench_sweep
+ *   DESCRIPTION: Scroll the photo in one direction until it reaches the
+ *                edge, recording one benchmark frame per step.  A frame
+ *                is a move_photo_* call followed by show_screen, as in
+ *                the game loop.
+ *   INPUTS: move -- the move_photo_* function
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: moves the view window; draws to the(emulated) screen
+ */
+static void bench_sweep(void (*move)(void)) {
+    unsigned int old_x, old_y; /* view window before the step */
+    uint64_t start;            /* start time of the frame     */
+
+    while (1) {
+        old_x = game_info.map_x;
+        old_y = game_info.map_y;
+        start = bench_now_ns();
+        (*move)();
+        if (old_x == game_info.map_x && old_y == game_info.map_y) {
+            /* Reached the edge: discard the partial frame. */
+            bench_view.frame_ns = bench_draw.frame_ns = 0;
+            return;
+        }
+        show_screen();
+        bench_stage_add(&bench_frame, bench_now_ns() - start);
+        bench_stage_end_frame(&bench_view);
+        bench_stage_end_frame(&bench_draw);
+        bench_stage_end_frame(&bench_show);
+        bench_stage_end_frame(&bench_frame);
+    }
+}
+
+
+/*
+ * bench_run
+ *   DESCRIPTION: Benchmark scrolling around the current room at one speed.
+ *                The room is entered as in the game loop, then swept
+ *                right, down, left, and up BENCH_PASSES times, and then
+ *                shown BENCH_IDLE_FRAMES times without moving.  Results
+ *                are printed and written to a file.
+ *   INPUTS: run -- name of the run in reports
+ *           speed -- pixels moved per step in each direction
+ *           out -- file for machine-readable results
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if memory allocation fails
+ *   SIDE EFFECTS: moves the view window; draws to the(emulated) screen
+ */
+static int32_t bench_run(const char* run, int32_t speed, FILE* out) {
+    bench_stage_t* stages[5] = {&bench_view, &bench_draw, &bench_show, &bench_frame, &bench_idle};
+    int32_t i;    /* index over stages */
+    int32_t pass; /* index over passes */
+    uint64_t start; /* start time of an idle frame */
+
+    if (0 != bench_stage_init(&bench_view, "set_view_window", BENCH_MAX_FRAMES) ||
+        0 != bench_stage_init(&bench_draw, "draw_line", BENCH_MAX_FRAMES) ||
+        0 != bench_stage_init(&bench_show, "show_screen", BENCH_MAX_FRAMES) ||
+        0 != bench_stage_init(&bench_frame, "frame", BENCH_MAX_FRAMES) ||
+        0 != bench_stage_init(&bench_idle, "show_screen_idle", BENCH_IDLE_FRAMES))
+        return -1;
+
+    /* Enter the room(untimed). */
+    game_info.x_speed = game_info.y_speed = speed;
+    game_info.map_x = game_info.map_y = 0;
+    set_view_window(game_info.map_x, game_info.map_y);
+    prep_room(game_info.where);
+    redraw_room();
+    show_screen();
+    for (i = 0; 4 > i; i++) {
+        stages[i]->frame_ns = 0;
+    }
+
+    for (pass = 0; BENCH_PASSES > pass; pass++) {
+        bench_sweep(move_photo_left);
+        bench_sweep(move_photo_up);
+        bench_sweep(move_photo_right);
+        bench_sweep(move_photo_down);
+    }
+    for (i = 0; BENCH_IDLE_FRAMES > i; i++) {
+        start = bench_now_ns();
+        show_screen();
+        bench_stage_add(&bench_idle, bench_now_ns() - start);
+        bench_stage_end_frame(&bench_idle);
+    }
+
+    for (i = 0; 5 > i; i++) {
+        bench_report(stdout, run, stages[i]);
+        bench_report(out, run, stages[i]);
+        bench_stage_free(stages[i]);
+    }
+    return 0;
+}
+
+
+/*
+ * main
+ *   DESCRIPTION: Benchmark the scroll path(move_photo_* and show_screen)
+ *                in the starting room using the emulated VGA, at normal
+ *                speed and at the 3x speed given by the board or jetpack.
+ *                Each speed is run with the rectangle fill callback
+ *                (fill_rect_buffer) and again with the line callbacks
+ *                alone(runs ending in _lines).  Writes results, and the
+ *                memory used by column copies of photos(compare with
+ *                -DPHOTO_TRANSPOSE_BUDGET=0), to bench_output.txt.
+ *   INPUTS: none(command line arguments are ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, 3 in panic situations
+ */
+int main() {
+    FILE* out; /* machine-readable results */
+
+    if (!build_world ()) {PANIC ("can't build world");}
+    init_game ();
+
+    if (NULL == (out = fopen ("bench_output.txt", "w"))) {
+        PANIC ("cannot open bench_output.txt");
+    }
+    if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer, fill_rect_buffer,
+                         VGA_EMULATED)) {
+        PANIC ("cannot initialize mode X");
+    }
+    printf ("room %s: %dx%d\n", room_name (game_info.where),
+            room_photo_width (game_info.where), room_photo_height (game_info.where));
+    if (0 != bench_run ("speed_1x", MOTION_SPEED, out) ||
+        0 != bench_run ("speed_3x", MOTION_SPEED * 3, out)) {
+        PANIC ("out of memory");
+    }
+    clear_mode_X ();
+    if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer, NULL,
+                         VGA_EMULATED)) {
+        PANIC ("cannot initialize mode X");
+    }
+    if (0 != bench_run ("speed_1x_lines", MOTION_SPEED, out) ||
+        0 != bench_run ("speed_3x_lines", MOTION_SPEED * 3, out)) {
+        PANIC ("out of memory");
+    }
+    photo_transpose_report (stdout);
+    photo_transpose_report (out);
+    clear_mode_X ();
+    (void)fclose (out);
+    return 0;
 }
 
+#else /* !defined(SCROLL_BENCHMARK_PROGRAM) */
 
 /*
  * main
@@ -869,52 +993,42 @@ int main() {
 
     init();
 
-	/* Create tux thread. */
-    if (0 != pthread_create (&tux_thread_id, NULL, tux_thread, NULL)) {
-        PANIC ("failed to create tux thread");
+    /* Start mode X. */
+    if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer, 
+			 fill_rect_buffer, VGA_HARDWARE)) {
+	PANIC ("cannot initialize mode X");
     }
-    push_cleanup (cancel_tux_thread, NULL); {
+    push_cleanup ((cleanup_fn_t)clear_mode_X, NULL); {
 
-
-
-    /* Create status message thread. */
-    if (0 != pthread_create (&status_thread_id, NULL, status_thread, NULL)) {
-        PANIC ("failed to create status thread");
-    }
-    push_cleanup (cancel_status_thread, NULL); {
-
-	/* Start mode X. */
-	if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer)) {
-	    PANIC ("cannot initialize mode X");
+	/* Initialize the keyboard and/or Tux controller. */
+	if (0 != init_input ()) {
+	    PANIC ("cannot initialize input");
 	}
-	push_cleanup ((cleanup_fn_t)clear_mode_X, NULL); {
-
-	    /* Initialize the keyboard and/or Tux controller. */
-	    if (0 != init_input ()) {
-		PANIC ("cannot initialize input");
-	    }
-	    push_cleanup ((cleanup_fn_t)shutdown_input, NULL); {
-
-		game = game_loop ();
+	push_cleanup ((cleanup_fn_t)shutdown_input, NULL); {
 
-	    } pop_cleanup (1);
+	    game = game_loop ();
 
 	} pop_cleanup (1);
 
     } pop_cleanup (1);
 
-	} pop_cleanup (1);
-
     /* Print a message about the outcome. */
     switch (game) {
 	case GAME_WON: printf ("You win the game!  CONGRATULATIONS!\n"); break;
 	case GAME_QUIT: printf ("Quitter!\n"); break;
     }
 
+    /* Report ticks that the game loop was too busy to run. */
+    if (0 != game_ticks.missed) {
+	printf ("Missed ticks: %lu of %lu\n", game_ticks.missed, game_ticks.ticks);
+    }
+
     /* Return success. */
     return 0;
 }
 
+#endif /* SCROLL_BENCHMARK_PROGRAM */
+
 
 #ifndef NDEBUG
 
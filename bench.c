@@ -0,0 +1,163 @@
+/* tab:4
+ *
+ * bench.c - benchmark timing and statistics helpers
+ *
+ * Filename:      bench.c
+ * History:
+ *    1    Added for the scroll path benchmark.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+
+/* local functions--see function headers for details */
+static int compare_samples(const void* a, const void* b);
+
+
+/*
+ * bench_now_ns
+ *   DESCRIPTION: Read the monotonic clock.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the current time in nanoseconds(from an arbitrary origin)
+ *   SIDE EFFECTS: none
+ */
+uint64_t bench_now_ns() {
+    struct timespec ts; /* current time */
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * bench_stage_init
+ *   DESCRIPTION: Initialize a benchmark stage with room for a fixed number
+ *                of samples.
+ *   INPUTS: name -- the stage name used in reports(not copied)
+ *           max_samples -- the maximum number of samples recorded
+ *   OUTPUTS: s -- the initialized stage
+ *   RETURN VALUE: 0 on success, -1 if memory allocation fails
+ *   SIDE EFFECTS: allocates memory(release with bench_stage_free)
+ */
+int32_t bench_stage_init(bench_stage_t* s, const char* name,
+                         int32_t max_samples) {
+    s->name = name;
+    s->n_samples = 0;
+    s->max_samples = max_samples;
+    s->frame_ns = 0;
+    if (NULL == (s->samples = malloc(max_samples * sizeof (s->samples[0]))))
+        return -1;
+    return 0;
+}
+
+
+/*
+ * bench_stage_free
+ *   DESCRIPTION: Release the samples held by a benchmark stage.
+ *   INPUTS: s -- the stage
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees memory
+ */
+void bench_stage_free(bench_stage_t* s) {
+    free(s->samples);
+    s->samples = NULL;
+    s->n_samples = s->max_samples = 0;
+}
+
+
+/*
+ * bench_stage_add
+ *   DESCRIPTION: Add time spent in a stage to the stage's current frame.
+ *   INPUTS: s -- the stage
+ *           ns -- the time spent in nanoseconds
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void bench_stage_add(bench_stage_t* s, uint64_t ns) {
+    s->frame_ns += ns;
+}
+
+
+/*
+ * bench_stage_end_frame
+ *   DESCRIPTION: Record the time accumulated in the current frame as a
+ *                sample, then start a new frame.  Samples beyond the
+ *                space allocated are dropped.
+ *   INPUTS: s -- the stage
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void bench_stage_end_frame(bench_stage_t* s) {
+    if (s->n_samples < s->max_samples)
+        s->samples[s->n_samples++] = s->frame_ns;
+    s->frame_ns = 0;
+}
+
+
+/*
+ * compare_samples
+ *   DESCRIPTION: Comparison function for sorting samples with qsort.
+ *   INPUTS: a, b -- pointers to the two samples
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as *a is less than, equal
+ *                 to, or greater than *b
+ *   SIDE EFFECTS: none
+ */
+static int compare_samples(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a; /* first sample  */
+    uint64_t y = *(const uint64_t*)b; /* second sample */
+
+    return (x > y) - (x < y);
+}
+
+
+/*
+ * bench_percentile
+ *   DESCRIPTION: Find a percentile of the samples recorded for a stage
+ *                (nearest-rank method).
+ *   INPUTS: s -- the stage
+ *           pct -- the percentile, from 0 to 100
+ *   OUTPUTS: none
+ *   RETURN VALUE: the percentile in nanoseconds, or 0 if no samples
+ *   SIDE EFFECTS: sorts the samples
+ */
+uint64_t bench_percentile(bench_stage_t* s, int32_t pct) {
+    int32_t rank; /* index of the sample at the percentile */
+
+    if (0 == s->n_samples)
+        return 0;
+    qsort(s->samples, s->n_samples, sizeof (s->samples[0]), compare_samples);
+    rank = (int32_t)(((int64_t)pct * s->n_samples + 99) / 100) - 1;
+    if (0 > rank)
+        rank = 0;
+    if (s->n_samples <= rank)
+        rank = s->n_samples - 1;
+    return s->samples[rank];
+}
+
+
+/*
+ * bench_report
+ *   DESCRIPTION: Write the sample count and the p50, p99, and maximum
+ *                of a stage to a file as one line of key=value pairs.
+ *   INPUTS: f -- the file
+ *           run -- name of the benchmark run
+ *           s -- the stage
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sorts the samples; writes to the file
+ */
+void bench_report(FILE* f, const char* run, bench_stage_t* s) {
+    fprintf(f, "run=%s stage=%s samples=%d p50_ns=%llu p99_ns=%llu "
+            "max_ns=%llu\n", run, s->name, s->n_samples,
+            (unsigned long long)bench_percentile(s, 50),
+            (unsigned long long)bench_percentile(s, 99),
+            (unsigned long long)bench_percentile(s, 100));
+}
@@ -0,0 +1,56 @@
+/* tab:4
+ *
+ * bench.h - header file for benchmark timing and statistics helpers
+ *
+ * Filename:      bench.h
+ * History:
+ *    1    Added for the scroll path benchmark.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+/*
+ * A benchmark stage collects one sample per frame(or per iteration).
+ * Time spent in the stage is added up over the course of the frame with
+ * bench_stage_add, and bench_stage_end_frame records the total as a
+ * sample.  Samples are kept in nanoseconds.
+ */
+typedef struct {
+    const char* name;       /* stage name used in reports           */
+    uint64_t*   samples;    /* recorded samples(nanoseconds)        */
+    int32_t     n_samples;  /* number of samples recorded           */
+    int32_t     max_samples;/* size of samples array                */
+    uint64_t    frame_ns;   /* time accumulated in current frame    */
+} bench_stage_t;
+
+/* Read the monotonic clock in nanoseconds. */
+extern uint64_t bench_now_ns();
+
+/* Allocate room for samples; returns 0 on success, -1 on failure. */
+extern int32_t bench_stage_init(bench_stage_t* s, const char* name,
+                                int32_t max_samples);
+
+/* Release the samples of a stage. */
+extern void bench_stage_free(bench_stage_t* s);
+
+/* Add time spent in the stage to the current frame. */
+extern void bench_stage_add(bench_stage_t* s, uint64_t ns);
+
+/* Record the current frame's total as a sample and start a new frame. */
+extern void bench_stage_end_frame(bench_stage_t* s);
+
+/* Get a percentile(0 to 100) of the samples recorded so far. */
+extern uint64_t bench_percentile(bench_stage_t* s, int32_t pct);
+
+/*
+ * Write one line with the p50/p99/max of a stage to a file.  The line
+ * is a list of key=value pairs for easy parsing by scripts.
+ */
+extern void bench_report(FILE* f, const char* run, bench_stage_t* s);
+
+#endif /* BENCH_H */
@@ -45,11 +45,14 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/io.h>
+#include <sys/timerfd.h>
 #include <termio.h>
 #include <termios.h>
 #include <unistd.h>
@@ -68,24 +71,97 @@
 
 /* stores original terminal settings */
 static struct termios tio_orig;
-static int fd;
+static int fd = -1;     /* Tux controller(or stand-in), or -1 if none */
 static cmd_t prev_cmd = CMD_NONE;
 
+/*
+ * Input devices are waited for with epoll: stdin, the Tux controller,
+ * and a timer for the caller's deadline are all in the set epoll_fd.
+ * The Tux driver reports button changes through the TUX_BUTTONS ioctl,
+ * so a real Tux is also read on every tick(see input_needs_ticks).  The
+ * stand-in device(open_tux_standin) is a pipe that takes the place of a
+ * Tux for tests: each byte written to it is a new button state, in the
+ * same form as the low byte from TUX_BUTTONS(active low), and the game
+ * wakes up as soon as it arrives.
+ */
+static int epoll_fd = -1;               /* devices and deadline timer   */
+static int timer_fd = -1;               /* deadline(CLOCK_MONOTONIC)    */
+static int tux_standin = 0;             /* 1 if fd is the stand-in pipe */
+static unsigned char standin_buttons = 0xFF; /* stand-in button state   */
+static int tux_read_since_tick = 0;     /* Tux read between two ticks   */
+
+static cmd_t tux_buttons_to_cmd(unsigned long arg);
+
 
 /*
  * init
- *   DESCRIPTION: open the file and initialize
+ *   DESCRIPTION: open the Tux controller and initialize it
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: open the file and initialize
+ *   SIDE EFFECTS: opens the serial port; if the Tux controller driver
+ *                 does not accept TUX_INIT, closes it again and runs
+ *                 without a Tux
  */
 void init()
 {
     fd = open("/dev/ttyS0", O_RDWR | O_NOCTTY);
+    if (-1 == fd)
+        return;
     int ldsic_num = N_MOUSE;
-    ioctl(fd, TIOCSETD, &ldsic_num);
-    ioctl(fd, TUX_INIT);
+    if (0 != ioctl(fd, TIOCSETD, &ldsic_num) || 0 != ioctl(fd, TUX_INIT)) {
+        (void)close(fd);
+        fd = -1;
+        return;
+    }
+
+    /* Anything the driver passes up is drained without blocking. */
+    (void)fcntl(fd, F_SETFL, O_NONBLOCK);
+}
+
+/*
+ * open_tux_standin
+ *   DESCRIPTION: Replace the Tux controller with a local stand-in device
+ *                (a pipe), so that Tux input can be tested without one.
+ *                Must be called before init_input.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the file descriptor to which button states are
+ *                 written(one byte each, active low), or -1 on failure
+ *   SIDE EFFECTS: closes the Tux controller, if open
+ */
+int open_tux_standin()
+{
+    int ends[2];    /* read and write ends of the pipe */
+
+    if (0 != pipe(ends))
+        return -1;
+    (void)fcntl(ends[0], F_SETFL, O_NONBLOCK);
+    if (-1 != fd)
+        (void)close(fd);
+    fd = ends[0];
+    tux_standin = 1;
+    standin_buttons = 0xFF;
+    return ends[1];
+}
+
+/*
+ * add_to_epoll
+ *   DESCRIPTION: Add a file descriptor to the epoll set, waiting for it
+ *                to become readable.
+ *   INPUTS: dev -- the file descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure(errno is set)
+ *   SIDE EFFECTS: changes the epoll set
+ */
+static int add_to_epoll(int dev)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = dev;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dev, &ev);
 }
 
 /*
@@ -134,14 +210,148 @@ int init_input() {
         return -1;
     }
 
-    fd = open("/dev/ttyS0", O_RDWR | O_NOCTTY);
-    int ldsic_num = N_MOUSE;
-    ioctl(fd, TIOCSETD, &ldsic_num);
+    /*
+     * Wait for the keyboard, the Tux controller(opened by init), and the
+     * deadline timer together.
+     */
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (-1 == epoll_fd || -1 == timer_fd || 0 != add_to_epoll(timer_fd)) {
+        perror("epoll or timerfd for input");
+        return -1;
+    }
+    if (0 != add_to_epoll(fileno(stdin))) {
+        perror("epoll_ctl to wait for stdin");
+        return -1;
+    }
+    if (-1 != fd && 0 != add_to_epoll(fd)) {
+        perror("epoll_ctl to wait for Tux controller");
+        return -1;
+    }
 
     /* Return success. */
     return 0;
 }
 
+/*
+ * input_needs_ticks
+ *   DESCRIPTION: Check whether input must be read on every tick, rather
+ *                than only when a device becomes readable: the real Tux
+ *                is read through an ioctl, and a held direction button
+ *                on the stand-in repeats on every tick.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if poll_input should be called on every tick, else 0
+ *   SIDE EFFECTS: none
+ */
+int input_needs_ticks()
+{
+    if (-1 == fd)
+        return 0;
+    if (!tux_standin)
+        return 1;
+    switch (standin_buttons) {
+        case right: case left: case down: case up:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * poll_input
+ *   DESCRIPTION: Read the Tux if it must be read on every tick(see
+ *                input_needs_ticks), pushing its command into the ring.
+ *                The Tux is not read again if it has been read since
+ *                the last tick.
+ *   INPUTS: tux -- the Tux command ring
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of commands pushed
+ *   SIDE EFFECTS: reads the Tux
+ */
+int poll_input(cmd_ring_t* tux)
+{
+    int n_pushed = 0;   /* commands pushed into the ring  */
+    cmd_t cmd;          /* command from the Tux           */
+
+    if (!tux_read_since_tick && input_needs_ticks()) {
+        cmd = get_tux_command();
+        if (CMD_NONE != cmd)
+            n_pushed += (0 == cmd_ring_push(tux, cmd));
+    }
+    tux_read_since_tick = 0;
+    return n_pushed;
+}
+
+/*
+ * wait_for_input
+ *   DESCRIPTION: Sleep until an input device becomes readable or until a
+ *                deadline passes, whichever comes first, then read the
+ *                readable devices, pushing their commands into the rings.
+ *                A signal also ends the wait.
+ *   INPUTS: kbd -- the keyboard command ring
+ *           tux -- the Tux command ring
+ *           deadline -- absolute CLOCK_MONOTONIC time at which to stop
+ *                       waiting, or NULL to wait for input only
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of commands pushed, or -1 on failure
+ *   SIDE EFFECTS: reads the devices
+ */
+int wait_for_input(cmd_ring_t* kbd, cmd_ring_t* tux,
+                   const struct timespec* deadline)
+{
+    struct epoll_event evs[3];  /* readable devices           */
+    struct itimerspec its;      /* deadline for timer         */
+    unsigned char buf[64];      /* bytes from the Tux         */
+    ssize_t len;                /* number of bytes from Tux   */
+    uint64_t expirations;       /* timer expirations(ignored) */
+    int n_pushed = 0;           /* commands pushed            */
+    int n;                      /* number of readable devices */
+    int i;                      /* loop index over devices    */
+    cmd_t cmd;                  /* command from the Tux       */
+
+    /* Set the timer to the deadline, or turn it off. */
+    memset(&its, 0, sizeof (its));
+    if (NULL != deadline) {
+        its.it_value = *deadline;
+        /* A zero time would turn the timer off; 1 ns is long past. */
+        if (0 == its.it_value.tv_sec && 0 == its.it_value.tv_nsec)
+            its.it_value.tv_nsec = 1;
+    }
+    if (0 != timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL))
+        return -1;
+
+    n = epoll_wait(epoll_fd, evs, sizeof (evs) / sizeof (evs[0]), -1);
+    if (-1 == n)
+        return (EINTR == errno ? 0 : -1);
+
+    for (i = 0; i < n; i++) {
+        if (timer_fd == evs[i].data.fd) {
+            (void)read(timer_fd, &expirations, sizeof (expirations));
+        }
+        else if (fileno(stdin) == evs[i].data.fd) {
+            n_pushed += read_keyboard(kbd);
+        }
+        else if (fd == evs[i].data.fd) {
+            /* The last byte from the stand-in is its button state. */
+            while (0 < (len = read(fd, buf, sizeof (buf)))) {
+                if (tux_standin)
+                    standin_buttons = buf[len - 1];
+            }
+            if (0 == len && tux_standin) {
+                /* The writer has gone: release all buttons. */
+                (void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                standin_buttons = 0xFF;
+            }
+            cmd = get_tux_command();
+            if (CMD_NONE != cmd)
+                n_pushed += (0 == cmd_ring_push(tux, cmd));
+            tux_read_since_tick = 1;
+        }
+    }
+    return n_pushed;
+}
+
 /*
  * get_tux_command
  *   DESCRIPTION: manage different commands of buttons
@@ -154,7 +364,27 @@ cmd_t get_tux_command()
 {
     unsigned long arg;
     arg = 0;
-    ioctl(fd, TUX_BUTTONS, &arg);
+    if (-1 == fd)
+        return CMD_NONE;
+    if (tux_standin)
+        arg = standin_buttons;
+    else
+        ioctl(fd, TUX_BUTTONS, &arg);
+    return tux_buttons_to_cmd(arg);
+}
+
+/*
+ * tux_buttons_to_cmd
+ *   DESCRIPTION: Turn a Tux button state into a command.  Direction
+ *                buttons give their command for as long as they are
+ *                held; the others give theirs once per press.
+ *   INPUTS: arg -- button state from TUX_BUTTONS(active low)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the command, or CMD_NONE
+ *   SIDE EFFECTS: records the command to recognize held buttons
+ */
+static cmd_t tux_buttons_to_cmd(unsigned long arg)
+{
     cmd_t finished = CMD_NONE;    
     
     switch(arg & bitmask00FF)
@@ -202,6 +432,61 @@ cmd_t get_tux_command()
     return finished;
 }
 
+/*
+ * cmd_ring_push
+ *   DESCRIPTION: Add a command to the tail of a command ring, stamped
+ *                with the current time.
+ *   INPUTS: ring -- the command ring
+ *           cmd -- the command
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the ring is full(the command is
+ *                 dropped)
+ *   SIDE EFFECTS: none
+ */
+int cmd_ring_push(cmd_ring_t* ring, cmd_t cmd) {
+    cmd_event_t* ev;
+
+    if (CMD_RING_SIZE == ring->tail - ring->head)
+        return -1;
+    ev = &ring->events[ring->tail & (CMD_RING_SIZE - 1)];
+    ev->cmd = cmd;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ev->time);
+    ring->tail++;
+    return 0;
+}
+
+/*
+ * cmd_ring_peek
+ *   DESCRIPTION: Get the command at the head of a command ring without
+ *                removing it.
+ *   INPUTS: ring -- the command ring
+ *   OUTPUTS: ev -- the command and the time at which it was read
+ *   RETURN VALUE: 1 if the ring holds a command, 0 if it is empty
+ *   SIDE EFFECTS: none
+ */
+int cmd_ring_peek(cmd_ring_t* ring, cmd_event_t* ev) {
+    if (ring->head == ring->tail)
+        return 0;
+    *ev = ring->events[ring->head & (CMD_RING_SIZE - 1)];
+    return 1;
+}
+
+/*
+ * cmd_ring_pop
+ *   DESCRIPTION: Remove the command at the head of a command ring.
+ *   INPUTS: ring -- the command ring
+ *   OUTPUTS: ev -- the command and the time at which it was read
+ *   RETURN VALUE: 1 if a command was removed, 0 if the ring was empty
+ *   SIDE EFFECTS: frees the command's slot
+ */
+int cmd_ring_pop(cmd_ring_t* ring, cmd_event_t* ev) {
+    if (ring->head == ring->tail)
+        return 0;
+    *ev = ring->events[ring->head & (CMD_RING_SIZE - 1)];
+    ring->head++;
+    return 1;
+}
+
 static char typing[MAX_TYPED_LEN + 1] = {'\0'};
 
 const char* get_typed_command() {
@@ -232,31 +517,31 @@ static void typed_a_char(char c) {
 }
 
 /*
- * get_command
- *   DESCRIPTION: Reads a command from the input controller.  As some
- *                controllers provide only absolute input(e.g., go
- *                right), the current direction is needed as an input
- *                to this routine.
- *   INPUTS: cur_dir -- current direction of motion
+ * read_keyboard
+ *   DESCRIPTION: Reads commands from the keyboard, pushing each one into
+ *                a command ring as it is recognized.  Typed characters
+ *                are added to the typed command.
+ *   INPUTS: ring -- the keyboard command ring
  *   OUTPUTS: none
- *   RETURN VALUE: command issued by the input controller
+ *   RETURN VALUE: number of commands pushed
  *   SIDE EFFECTS: drains any keyboard input
  */
-cmd_t get_command() {
+int read_keyboard(cmd_ring_t* ring) {
 
 #if (USE_TUX_CONTROLLER == 0) /* use keyboard control with arrow keys */
     static int state = 0;                 /* small FSM for arrow keys */
 #endif
-    static cmd_t command = CMD_NONE;
-    cmd_t pushed = CMD_NONE;
+    cmd_t pushed;       /* command recognized from a character */
+    int n_pushed = 0;   /* commands pushed into the ring        */
     int ch;
 
     /* Read all characters from stdin. */
     while ((ch = getc(stdin)) != EOF) {
+        pushed = CMD_NONE;
 
         /* Backquote is used to quit the game. */
         if (ch == '`')
-            return CMD_QUIT;
+            return n_pushed + (0 == cmd_ring_push(ring, CMD_QUIT));
 
 #if (USE_TUX_CONTROLLER == 0) /* use keyboard control with arrow keys */
 
@@ -353,16 +638,13 @@ cmd_t get_command() {
             pushed = CMD_TYPED;
         }
 #endif /* USE_TUX_CONTROLLER */
-    }
 
-    /*
-     * Once a direction is pushed, that command remains active
-     * until a turn is taken.
-     */
-    if (pushed == CMD_NONE) {
-        command = CMD_NONE;
+        /* Queue each command as soon as it is recognized. */
+        if (CMD_NONE != pushed)
+            n_pushed += (0 == cmd_ring_push(ring, pushed));
     }
-    return pushed;
+
+    return n_pushed;
 }
 
 /*
@@ -372,10 +654,16 @@ cmd_t get_command() {
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: restores original terminal settings
+ *   SIDE EFFECTS: restores original terminal settings; closes the epoll
+ *                 set and deadline timer
  */
 void shutdown_input() {
     (void)tcsetattr(fileno(stdin), TCSANOW, &tio_orig);
+    if (-1 != epoll_fd) {
+        (void)close(epoll_fd);
+        (void)close(timer_fd);
+        epoll_fd = timer_fd = -1;
+    }
 }
 
 
@@ -400,33 +688,147 @@ void display_time_on_tux(int num_seconds) {
     
     display_val |= ((minutes / 10) << 12) | ((minutes % 10) << 8) | ((seconds / 10) << 4) | (seconds % 10);
 
-    ioctl(fd, TUX_SET_LED, display_val);
+    if (-1 != fd && !tux_standin)
+        ioctl(fd, TUX_SET_LED, display_val);
 }
 
 
 #if (TEST_INPUT_DRIVER == 1)
-int main() {
-    cmd_t last_cmd = CMD_NONE;
-    cmd_t cmd;
+
+#define DRIVER_TICK_NSEC 50000000L  /* tick length in nanoseconds */
+
+/*
+ * standin_script
+ *   DESCRIPTION: Press buttons on the stand-in Tux controller: hold right
+ *                for a quarter of a second, release, then press and
+ *                release A, B and C.  Run in a child of the test driver.
+ *   INPUTS: dev -- the stand-in(from open_tux_standin)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes button states to the stand-in
+ */
+static void standin_script(int dev)
+{
+    static const unsigned char press[] = {a_button, b_button, c_button};
+    unsigned char state;    /* button state(active low) */
+    int i;                  /* loop index over presses  */
+
+    usleep(100000);
+    state = right;
+    (void)write(dev, &state, 1);
+    usleep(250000);
+    for (i = 0; i < sizeof (press); i++) {
+        state = 0xFF;
+        (void)write(dev, &state, 1);
+        usleep(100000);
+        state = press[i];
+        (void)write(dev, &state, 1);
+        usleep(100000);
+    }
+    state = 0xFF;
+    (void)write(dev, &state, 1);
+}
+
+/*
+ * time_passed
+ *   DESCRIPTION: Check whether one time is at or after another.
+ *   INPUTS: now -- the first time
+ *           t -- the second time
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if now >= t, else 0
+ *   SIDE EFFECTS: none
+ */
+static int time_passed(const struct timespec* now, const struct timespec* t)
+{
+    if (now->tv_sec != t->tv_sec)
+        return (now->tv_sec > t->tv_sec);
+    return (now->tv_nsec >= t->tv_nsec);
+}
+
+/*
+ * The test driver waits for input as the game does, printing each
+ * command as it arrives.  With -s, the Tux controller is replaced by the
+ * stand-in device, and a child process presses some buttons on it(see
+ * standin_script).  Quit with the keyboard('`') or Tux(start) quit
+ * command.
+ */
+int main(int argc, char** argv) {
+    static cmd_ring_t kbd, tux;
     static const char* const cmd_name[NUM_COMMANDS] = {
         "none", "right", "left", "up", "down", "move left",
         "enter", "move right", "typed command", "quit"
     };
-
-    /* Grant ourselves permission to use ports 0-1023 */
-    if (ioperm(0, 1024, 1) == -1) {
-        perror("ioperm");
-        return 3;
+    cmd_event_t ev;
+    struct timespec now;        /* current time                  */
+    struct timespec next;       /* time of next tick             */
+    struct timespec start;      /* time of start                 */
+    unsigned long ticks = 0;    /* ticks on which input was read */
+    int standin;                /* 1 if using the stand-in       */
+    int dev;                    /* stand-in, to write buttons    */
+    int ticking;                /* 1 if waiting for a tick       */
+    int quit = 0;
+
+    standin = (1 < argc && 0 == strcmp(argv[1], "-s"));
+    if (standin) {
+        if (-1 == (dev = open_tux_standin())) {
+            perror("open_tux_standin");
+            return 3;
+        }
+        if (0 == fork()) {
+            standin_script(dev);
+            _exit(0);
+        }
+        (void)close(dev);
+    }
+    else {
+        /* Grant ourselves permission to use ports 0-1023 */
+        if (ioperm(0, 1024, 1) == -1) {
+            perror("ioperm");
+            return 3;
+        }
+        init();
     }
 
-    init_input();
-    while (1) {
-        while ((cmd = get_command()) == last_cmd);
-        last_cmd = cmd;
-        printf("command issued: %s\n", cmd_name[cmd]);
-        if (cmd == CMD_QUIT)
+    if (0 != init_input())
+        return 3;
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    now = start;
+    ticking = 0;
+    while (!quit) {
+        /*
+         * Wait for input, or for the next tick if input must be polled;
+         * ticks start one tick after polling becomes necessary.
+         */
+        if (!ticking && input_needs_ticks()) {
+            next = now;
+            ticking = 1;
+        }
+        else if (!input_needs_ticks()) {
+            ticking = 0;
+        }
+        if (ticking && time_passed(&now, &next)) {
+            if ((next.tv_nsec += DRIVER_TICK_NSEC) >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+        }
+        if (-1 == wait_for_input(&kbd, &tux, ticking ? &next : NULL)) {
+            perror("wait_for_input");
             break;
-        display_time_on_tux(83);
+        }
+        (void)clock_gettime(CLOCK_MONOTONIC, &now);
+        if (ticking && time_passed(&now, &next)) {
+            (void)poll_input(&tux);
+            display_time_on_tux(++ticks / (1000000000L / DRIVER_TICK_NSEC));
+        }
+        while (cmd_ring_pop(&kbd, &ev) || cmd_ring_pop(&tux, &ev)) {
+            printf("%6.3f s: command issued: %s\n",
+                   (ev.time.tv_sec - start.tv_sec) +
+                   (ev.time.tv_nsec - start.tv_nsec) / 1e9, cmd_name[ev.cmd]);
+            if (CMD_QUIT == ev.cmd)
+                quit = 1;
+        }
+        (void)fflush(stdout);
     }
     shutdown_input();
     return 0;
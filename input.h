@@ -38,6 +38,8 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include <time.h>
+
 /* possible commands from input device, whether keyboard or game controller */
 typedef enum {
     CMD_NONE, CMD_RIGHT, CMD_LEFT, CMD_UP, CMD_DOWN,
@@ -47,6 +49,29 @@ typedef enum {
     NUM_COMMANDS
 } cmd_t;
 
+/*
+ * A command read from an input device, with the CLOCK_MONOTONIC time at
+ * which it was read.
+ */
+typedef struct {
+    cmd_t           cmd;        /* command issued               */
+    struct timespec time;       /* time at which it was read    */
+} cmd_event_t;
+
+/*
+ * Queue of commands from one input device to the game loop, in the
+ * order in which they were read.  Commands are pushed as the device is
+ * read and popped by the game loop, both on the game loop's thread, so
+ * the ring needs no lock.  head and tail count the commands popped and
+ * pushed.  CMD_RING_SIZE must be a power of two.
+ */
+#define CMD_RING_SIZE 64
+typedef struct {
+    unsigned int head;                  /* commands popped  */
+    unsigned int tail;                  /* commands pushed  */
+    cmd_event_t  events[CMD_RING_SIZE];
+} cmd_ring_t;
+
 #define MAX_TYPED_LEN 20
 #define display1 0x04070000 //display value
 #define display2 0x040F0000 //display value
@@ -64,8 +89,33 @@ typedef enum {
 /* Initialize the input device. */
 extern int init_input();
 
-/* Read a command from the input device. */
-extern cmd_t get_command();
+/* Push a command into a ring; -1 if the ring is full. */
+extern int cmd_ring_push(cmd_ring_t* ring, cmd_t cmd);
+
+/* Look at the oldest command in a ring; 0 if it is empty. */
+extern int cmd_ring_peek(cmd_ring_t* ring, cmd_event_t* ev);
+
+/* Pop the oldest command from a ring; 0 if it is empty. */
+extern int cmd_ring_pop(cmd_ring_t* ring, cmd_event_t* ev);
+
+/* Read the keyboard, pushing each command into a ring; returns count. */
+extern int read_keyboard(cmd_ring_t* ring);
+
+/*
+ * Sleep until input arrives or the deadline(CLOCK_MONOTONIC; NULL for
+ * none) passes, pushing commands into the rings; returns count.
+ */
+extern int wait_for_input(cmd_ring_t* kbd, cmd_ring_t* tux,
+                          const struct timespec* deadline);
+
+/* Check whether input must also be read on every tick(by poll_input). */
+extern int input_needs_ticks();
+
+/* Read the Tux if it must be read on every tick; returns count. */
+extern int poll_input(cmd_ring_t* tux);
+
+/* Replace the Tux with a pipe for tests; returns its write end. */
+extern int open_tux_standin();
 
 /* Get currently typed command string. */
 extern const char* get_typed_command();
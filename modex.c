@@ -42,11 +42,15 @@
 
 
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/io.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "modex.h"
 #include "text.h"
@@ -77,13 +81,41 @@
 #define BUILD_BUF_SIZE  (SCREEN_SIZE + 20000) 
 #define BUILD_BASE_INIT ((BUILD_BUF_SIZE - SCREEN_SIZE) / 2)
 
-/* Mode X and general VGA parameters */
+/* Mode X and general VGA parameters(see also modex.h) */
 #define VID_MEM_SIZE       131072
-#define MODE_X_MEM_SIZE     65536
-#define NUM_SEQUENCER_REGS      5
-#define NUM_CRTC_REGS          25
-#define NUM_GRAPHICS_REGS       9
-#define NUM_ATTR_REGS          22
+
+/*
+ * Hardware scrolling.  When compiled with MODEX_HW_SCROLL, video memory
+ * is not split into two display pages.  Instead, each plane above the
+ * status bar holds a canvas in which logical pixel (x,y) lives at
+ * address canvas_off + y * VID_ROW_BYTES + (x >> 2) of plane (x & 3).
+ * The CRTC start address(registers 0x0C/0x0D) points at the upper left
+ * byte of the logical view window, and horizontal pel panning(attribute
+ * register 0x13) shifts the screen by the remaining 0-3 pixels, so
+ * moving the view writes nothing to video memory; show_screen copies
+ * only the pixels drawn since the last call(the newly exposed strips).
+ * Rows are two bytes longer than the screen so that the extra byte
+ * read with a non-zero pel panning value does not come from the next
+ * row.  Pixels that share an address with an on-screen pixel are never
+ * on the screen at the same time.  When the view window drifts out of
+ * video memory, the canvas is moved back to the middle(CANVAS_INIT)
+ * and the whole screen is copied again.  With one canvas, pixels are
+ * written to the displayed image, so a frame may show partly drawn
+ * strips at its edges.
+ *
+ * VID_ROW_BYTES is the width of a row in video memory in both modes; the
+ * status bar uses it too, and so takes up STATUS_ROWS rows of it at
+ * address 0.
+ */
+#if defined(MODEX_HW_SCROLL)
+#define VID_ROW_BYTES   (SCROLL_X_WIDTH + 2)
+#else
+#define VID_ROW_BYTES   SCROLL_X_WIDTH
+#endif
+#define STATUS_ROWS     (size1440 / SCROLL_X_WIDTH)
+#define CANVAS_LOW      (STATUS_ROWS * VID_ROW_BYTES)
+#define CANVAS_SPAN     ((SCROLL_Y_DIM - 1) * VID_ROW_BYTES + SCROLL_X_WIDTH + 1)
+#define CANVAS_INIT     ((CANVAS_LOW + MODE_X_MEM_SIZE - CANVAS_SPAN) / 2)
 
 /* VGA register settings for mode X */
 static unsigned short mode_X_seq[NUM_SEQUENCER_REGS] = {
@@ -92,15 +124,16 @@ static unsigned short mode_X_seq[NUM_SEQUENCER_REGS] = {
 static unsigned short mode_X_CRTC[NUM_CRTC_REGS] = {
     0x5F00, 0x4F01, 0x5002, 0x8203, 0x5404, 0x8005, 0xBF06, 0x1F07,
     0x0008, 0x0109, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E, 0x000F,
-    0x9C10, 0x8E11, 0x8F12, 0x2813, 0x0014, 0x9615, 0xB916, 0xE317,
-    0x6B18
+    0x9C10, 0x8E11, 0x8F12, ((VID_ROW_BYTES / 2) << 8) | 0x13, 0x0014, 0x9615,
+    0xB916, 0xE317, 0x6B18
 };
+/* attribute mode control(0x10) keeps the status bar from panning */
 static unsigned char mode_X_attr[NUM_ATTR_REGS * 2] = {
     0x00, 0x00, 0x01, 0x01, 0x02, 0x02, 0x03, 0x03, 
     0x04, 0x04, 0x05, 0x05, 0x06, 0x06, 0x07, 0x07, 
     0x08, 0x08, 0x09, 0x09, 0x0A, 0x0A, 0x0B, 0x0B, 
     0x0C, 0x0C, 0x0D, 0x0D, 0x0E, 0x0E, 0x0F, 0x0F,
-    0x10, 0x41, 0x11, 0x00, 0x12, 0x0F, 0x13, 0x00,
+    0x10, 0x61, 0x11, 0x00, 0x12, 0x0F, 0x13, 0x00,
     0x14, 0x00, 0x15, 0x00
 };
 static unsigned short mode_X_graphics[NUM_GRAPHICS_REGS] = {
@@ -143,7 +176,18 @@ static void fill_palette_mode_x ();
 static void fill_palette_text ();
 static void write_font_data ();
 static void set_text_mode_3 (int clear_scr);
-static void copy_image (unsigned char* img, unsigned short scr_addr);
+static void copy_image (unsigned char* img, unsigned short scr_addr, int len);
+static void mark_dirty (int x0, int y0, int x1, int y1);
+#if defined(MODEX_HW_SCROLL)
+static void set_pel_panning (int pan);
+static void copy_rows (unsigned char* img, unsigned short scr_addr, int width, int rows);
+#endif
+static int open_emulated_vga ();
+static void emu_outb (unsigned short port, unsigned char val);
+static void emu_outw (unsigned short port, unsigned short val);
+static unsigned char emu_inb (unsigned short port);
+static void emu_write (unsigned short scr_addr, const unsigned char* src, int len);
+static void emu_fill (unsigned short scr_addr, unsigned char val, int len);
 
 /*
  * Images are built in this buffer, then copied to the video memory.
@@ -186,6 +230,42 @@ static int show_x, show_y;      /* logical view coordinates    */
 static unsigned char* mem_image;    /* pointer to start of video memory */
 static unsigned short target_img;   /* offset of displayed screen image */
 
+/*
+ * Parts of the logical view window that differ between the build buffer
+ * and each of the two display pages in video memory(page 0 at 1440 and
+ * page 1 at 1440 + 0x4000), as rectangles of screen pixels from (x0,y0)
+ * up to but not including (x1,y1); empty when x0 >= x1.  Drawing lines
+ * and moving the view window add to the rectangles of both pages;
+ * show_screen copies only the rectangle of the page that it fills, and
+ * does nothing at all if the displayed page is up to date.
+ */
+typedef struct dirty_rect_t {
+    int x0, y0, x1, y1;
+} dirty_rect_t;
+static dirty_rect_t page_dirty[2];      /* indexed by target_img >> 14    */
+
+#if defined(MODEX_HW_SCROLL)
+/*
+ * Hardware scrolling state(see VID_ROW_BYTES).  Only page_dirty[0] is
+ * used, for the canvas; shown_start and shown_pan record the registers
+ * last written, or -1 if they must be written.
+ */
+static int canvas_off;          /* address of logical pixel (0,0)  */
+static int shown_start;         /* CRTC start address shown        */
+static int shown_pan;           /* pel panning shown(0-3 pixels)   */
+#endif
+
+/*
+ * Emulated VGA, used in place of the hardware when set_mode_X is asked
+ * for the VGA_EMULATED backend.  The emu pointer is NULL when using the
+ * real hardware; the port and video memory macros below check it.  The
+ * emulated "video memory window" absorbs writes that bypass the planar
+ * model(text mode screens), just as /dev/mem would.
+ */
+static vga_emu_t emu_state;                     /* emulated VGA state   */
+static vga_emu_t* emu = NULL;                   /* NULL for hardware    */
+static unsigned char emu_window[VID_MEM_SIZE];  /* host memory window   */
+
 
 /* 
  * functions provided by the caller to set_mode_X() and used to obtain  
@@ -194,6 +274,13 @@ static unsigned short target_img;   /* offset of displayed screen image */
  */
 static void (*horiz_line_fn) (int, int, unsigned char[SCROLL_X_DIM]);
 static void (*vert_line_fn) (int, int, unsigned char[SCROLL_Y_DIM]);
+static void (*rect_fn) (int, int, int, int, unsigned char*, int);
+
+/* 
+ * buffer for the graphical image of a block of horizontal lines
+ * (draw_horiz_lines), stored row by row
+ */
+static unsigned char rect_buf[SCROLL_X_DIM * SCROLL_Y_DIM];
     
 
 /*
@@ -203,6 +290,9 @@ static void (*vert_line_fn) (int, int, unsigned char[SCROLL_Y_DIM]);
  */
 #define SET_WRITE_MASK(mask_hi_bits)                    \
 do {                                                    \
+    if (NULL != emu) {                                  \
+        emu_outw(0x03C4, ((mask_hi_bits) & 0xFF00) | 0x02); \
+    } else {                                            \
     asm volatile("                                    \n\
         movw $0x03C4, %%dx  /* set write mask */      \n\
         movb $0x02, %b0                               \n\
@@ -212,11 +302,15 @@ do {                                                    \
         : "a"((mask_hi_bits))                           \
         : "edx", "memory"                               \
     );                                                  \
+    }                                                   \
 } while (0)
 
 /* macro used to write a byte to a port */
 #define OUTB(port, val)                                 \
 do {                                                    \
+    if (NULL != emu) {                                  \
+        emu_outb((port), (val));                        \
+    } else {                                            \
     asm volatile("                                    \n\
         outb %b1, (%w0)                               \n\
         "                                               \
@@ -224,11 +318,15 @@ do {                                                    \
         : "d"((port)), "a"((val))                       \
         : "memory", "cc"                                \
     );                                                  \
+    }                                                   \
 } while (0)
 
 /* macro used to write two bytes to two consecutive ports */
 #define OUTW(port, val)                                 \
 do {                                                    \
+    if (NULL != emu) {                                  \
+        emu_outw((port), (val));                        \
+    } else {                                            \
     asm volatile("                                    \n\
         outw %w1, (%w0)                               \n\
         "                                               \
@@ -236,6 +334,7 @@ do {                                                    \
         : "d"((port)), "a"((val))                       \
         : "memory", "cc"                                \
     );                                                  \
+    }                                                   \
 } while (0)
 
 /*
@@ -243,6 +342,11 @@ do {                                                    \
  */
 #define REP_OUTSW(port, source, count)                  \
 do {                                                    \
+    if (NULL != emu) {                                  \
+        int emu_i;                                      \
+        for (emu_i = 0; emu_i < (count); emu_i++)       \
+            emu_outw((port), ((const unsigned short*)(source))[emu_i]); \
+    } else {                                            \
     asm volatile("                                    \n\
         1: movw 0(%1), %%ax                           \n\
         outw %%ax, (%w2)                              \n\
@@ -254,6 +358,7 @@ do {                                                    \
         : "c"((count)), "S"((source)), "d"((port))      \
         : "eax", "memory", "cc"                         \
     );                                                  \
+    }                                                   \
 } while (0)
 
 /*
@@ -261,6 +366,11 @@ do {                                                    \
  */
 #define REP_OUTSB(port, source, count)                  \
 do {                                                    \
+    if (NULL != emu) {                                  \
+        int emu_i;                                      \
+        for (emu_i = 0; emu_i < (count); emu_i++)       \
+            emu_outb((port), ((const unsigned char*)(source))[emu_i]); \
+    } else {                                            \
     asm volatile("                                    \n\
         1: movb 0(%1), %%al                           \n\
         outb %%al, (%w2)                              \n\
@@ -272,6 +382,7 @@ do {                                                    \
         : "c"((count)), "S"((source)), "d"((port))      \
         : "eax", "memory", "cc"                         \
     );                                                  \
+    }                                                   \
 } while (0)
 
 
@@ -286,13 +397,27 @@ do {                                                    \
  *                             draw_vert_line) to obtain a graphical
  *                             image of a particular logical line for
  *                             drawing to the build buffer
+ *             rect_fill_fn -- this function is used as a callback(by
+ *                             draw_horiz_lines) to obtain a
+ *                             graphical image of a rectangle of
+ *                             the logical view at once; arguments are
+ *                             the logical x, y, width and height of the
+ *                             rectangle and the buffer and its stride
+ *                             (bytes from one row to the next); may be
+ *                             NULL, in which case the line callbacks
+ *                             are used for each line
+ *             backend -- VGA_HARDWARE to drive the real VGA, or
+ *                        VGA_EMULATED to drive the software model
  *     OUTPUTS: none
  *     RETURN VALUE: 0 on success, -1 on failure
  *     SIDE EFFECTS: initializes the logical view window; maps video memory
- *                   and obtains permission for VGA ports; clears video memory
+ *                   and obtains permission for VGA ports(or resets the
+ *                   emulated VGA); clears video memory
  */
 int set_mode_X(void(*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
-               void(*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM])) {
+               void(*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM]),
+               void(*rect_fill_fn)(int, int, int, int, unsigned char*, int),
+               vga_backend_t backend) {
     int i; /* loop index for filling memory fence with magic numbers */
 
     /*
@@ -303,6 +428,7 @@ int set_mode_X(void(*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
         return -1;
     horiz_line_fn = horiz_fill_fn;
     vert_line_fn = vert_fill_fn;
+    rect_fn = rect_fill_fn;
 
     /* Initialize the logical view window to position(0,0). */
     show_x = show_y = 0;
@@ -318,8 +444,25 @@ int set_mode_X(void(*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
     /* One display page goes at the start of video memory. */
     target_img = 1440;
 
-    /* Map video memory and obtain permission for VGA port access. */
-    if (open_memory_and_ports() == -1)
+    /* Neither display page holds the build buffer yet(see clear_screens). */
+    page_dirty[0].x0 = page_dirty[1].x0 = SCROLL_X_DIM;
+    page_dirty[0].x1 = page_dirty[1].x1 = 0;
+
+#if defined(MODEX_HW_SCROLL)
+    /* Put the view window in the middle of the canvas. */
+    canvas_off = CANVAS_INIT;
+    shown_start = shown_pan = -1;
+#endif
+
+    /*
+     * Map video memory and obtain permission for VGA port access, or
+     * set up the emulated VGA in their place.
+     */
+    if (VGA_EMULATED == backend) {
+        if (open_emulated_vga() == -1)
+            return -1;
+    }
+    else if (open_memory_and_ports() == -1)
         return -1;
 
     /*
@@ -363,8 +506,9 @@ void clear_mode_X() {
     /* Put VGA into text mode, restore font data, and clear screens. */
     set_text_mode_3(1);
 
-    /* Unmap video memory. */
-    (void)munmap(mem_image, VID_MEM_SIZE);
+    /* Unmap video memory(the emulated window is not mapped). */
+    if (NULL == emu)
+        (void)munmap(mem_image, VID_MEM_SIZE);
 
     /* Check validity of build buffer memory fence.    Report breakage. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
@@ -397,7 +541,9 @@ void clear_mode_X() {
  *     OUTPUTS: none
  *     RETURN VALUE: none
  *     SIDE EFFECTS: may shift position of logical view window within build
- *                   buffer
+ *                   buffer; marks the whole screen dirty if the window
+ *                   moves(with MODEX_HW_SCROLL, only if the canvas in
+ *                   video memory must be moved)
  */
 void set_view_window(int scr_x, int scr_y) {
     int old_x, old_y;       /* old position of logical view window                              */
@@ -417,6 +563,36 @@ void set_view_window(int scr_x, int scr_y) {
     show_x = scr_x;
     show_y = scr_y;
 
+#if defined(MODEX_HW_SCROLL)
+    /*
+     * Pixels already on the canvas stay where they are when the window
+     * moves, so only the pixels drawn but not yet shown are followed to
+     * their new screen positions(dropping those now off the screen).
+     * If the window leaves video memory, the canvas is moved back to
+     * the middle, and the whole screen must be copied again.
+     */
+    start_off = canvas_off + scr_y * VID_ROW_BYTES + (scr_x >> 2);
+    if (start_off < CANVAS_LOW || start_off + CANVAS_SPAN > MODE_X_MEM_SIZE) {
+        canvas_off = CANVAS_INIT - scr_y * VID_ROW_BYTES - (scr_x >> 2);
+        mark_dirty(0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+    }
+    else if (page_dirty[0].x0 < page_dirty[0].x1) {
+        dirty_rect_t* d = &page_dirty[0];
+        d->x0 = (d->x0 + old_x - scr_x < 0 ? 0 : d->x0 + old_x - scr_x);
+        d->x1 = (d->x1 + old_x - scr_x > SCROLL_X_DIM ? 
+                 SCROLL_X_DIM : d->x1 + old_x - scr_x);
+        d->y0 = (d->y0 + old_y - scr_y < 0 ? 0 : d->y0 + old_y - scr_y);
+        d->y1 = (d->y1 + old_y - scr_y > SCROLL_Y_DIM ? 
+                 SCROLL_Y_DIM : d->y1 + old_y - scr_y);
+        if (d->y0 >= d->y1)
+            d->x1 = d->x0;
+    }
+#else
+    /* Every pixel on the screen changes if the window moves. */
+    if (scr_x != old_x || scr_y != old_y)
+        mark_dirty(0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+#endif
+
     /*
      * If the new view window fits within the boundaries of the build
      * buffer, we need move nothing around.
@@ -499,9 +675,136 @@ void set_view_window(int scr_x, int scr_y) {
 }
 
 
+/*
+ * mark_dirty
+ *     DESCRIPTION: Record that part of the logical view window has been
+ *                  changed in the build buffer, and so must be copied to
+ *                  both display pages.
+ *     INPUTS: (x0,y0) -- upper left pixel of changed rectangle within
+ *                        the logical view window
+ *             (x1,y1) -- pixel just past the lower right of the rectangle
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: grows the dirty rectangles of both pages
+ */
+static void mark_dirty(int x0, int y0, int x1, int y1) {
+    dirty_rect_t* d;        /* dirty rectangle of a page           */
+    int i;                  /* loop index over display pages       */
+
+    for (i = 0; i < 2; i++) {
+        d = &page_dirty[i];
+        if (d->x0 >= d->x1) {
+            d->x0 = x0;
+            d->y0 = y0;
+            d->x1 = x1;
+            d->y1 = y1;
+            continue;
+        }
+        if (d->x0 > x0) d->x0 = x0;
+        if (d->y0 > y0) d->y0 = y0;
+        if (d->x1 < x1) d->x1 = x1;
+        if (d->y1 < y1) d->y1 = y1;
+    }
+}
+
+
+#if defined(MODEX_HW_SCROLL)
+/*
+ * show_screen
+ *     DESCRIPTION: Show the logical view window on the video display by
+ *                  copying the part of the screen changed since the last
+ *                  call(see page_dirty) to the canvas in video memory,
+ *                  and then pointing the VGA at the window's place in the
+ *                  canvas.
+ *     INPUTS: none
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: copies from the build buffer to video memory; sets the
+ *                   VGA start address and pel panning if they change
+ */
+void show_screen() {
+    unsigned char* addr;    /* source address for copy             */
+    dirty_rect_t* d;        /* changed part of the screen          */
+    int start;              /* canvas address of view window       */
+    int pan;                /* pel panning of view window          */
+    int j0;                 /* first byte to copy in each row      */
+    int width;              /* bytes per row to copy               */
+    int i;                  /* loop index over video planes        */
+
+    start = canvas_off + show_y * VID_ROW_BYTES + (show_x >> 2);
+    pan = (show_x & 3);
+    d = &page_dirty[0];
+
+    if (d->x0 < d->x1) {
+        /*
+         * Byte j of a row of video plane i holds logical pixel
+         * (show_x & ~3) + 4j + i, which is in plane 3 - i of the build
+         * buffer.  Copy the bytes holding the changed pixels.
+         */
+        addr = img3 + (show_x >> 2) + (show_y + d->y0) * SCROLL_X_WIDTH;
+        j0 = ((pan + d->x0) >> 2);
+        width = ((pan + d->x1 + 3) >> 2) - j0;
+        for (i = 0; i < 4; i++) {
+            SET_WRITE_MASK(1 << (i + 8));
+            copy_rows(addr + (3 - i) * SCROLL_SIZE + j0,
+                      start + d->y0 * VID_ROW_BYTES + j0, width,
+                      d->y1 - d->y0);
+        }
+        d->x0 = SCROLL_X_DIM;
+        d->x1 = 0;
+    }
+
+    /* Move the VGA display source to the view window. */
+    if (start != shown_start) {
+        OUTW(0x03D4, (start & 0xFF00) | 0x0C);
+        OUTW(0x03D4, ((start & 0x00FF) << 8) | 0x0D);
+        shown_start = start;
+    }
+    if (pan != shown_pan) {
+        set_pel_panning(pan);
+        shown_pan = pan;
+    }
+}
+
+
+/*
+ * set_pel_panning
+ *     DESCRIPTION: Shift the scrolling part of the display left by a
+ *                  few pixels with the horizontal pel panning register.
+ *     INPUTS: pan -- number of pixels(0-3)
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: writes attribute register 0x13
+ */
+static void set_pel_panning(int pan) {
+    /* Reset attribute register to write index next rather than data. */
+    if (NULL != emu)
+        (void)emu_inb(0x03DA);
+    else
+    asm volatile("          \n\
+        inb (%%dx), %%al    \n\
+        "
+        :
+        : "d"(0x03DA)
+        : "eax", "memory"
+    );
+
+    /*
+     * Set bit 5 with the index to keep the display on; in 256-color
+     * modes, the register counts half pixels.
+     */
+    OUTB(0x03C0, 0x33);
+    OUTB(0x03C0, pan << 1);
+}
+#else
 /*
  * show_screen
  *     DESCRIPTION: Show the logical view window on the video display.
+ *                  If the displayed page is out of date, the other page
+ *                  is brought up to date by copying the part of the
+ *                  screen changed since it was last filled(see
+ *                  page_dirty), and then shown; otherwise nothing is
+ *                  done.
  *     INPUTS: none
  *     OUTPUTS: none
  *     RETURN VALUE: none
@@ -510,8 +813,17 @@ void set_view_window(int scr_x, int scr_y) {
  */
 void show_screen() {
     unsigned char* addr;    /* source address for copy             */
+    unsigned char* src;     /* source address of plane to copy     */
+    dirty_rect_t* d;        /* changed part of the page filled     */
     int p_off;              /* plane offset of first display plane */
+    int start;              /* offset of first byte to copy        */
+    int width;              /* bytes per row to copy               */
     int i;                  /* loop index over video planes        */
+    int y;                  /* loop index over rows                */
+
+    /* Nothing to do if the screen shown is up to date. */
+    if (page_dirty[target_img >> 14].x0 >= page_dirty[target_img >> 14].x1)
+        return;
 
     /*
      * Calculate offset of build buffer plane to be mapped into plane 0
@@ -521,16 +833,37 @@ void show_screen() {
 
     /* Switch to the other target screen in video memory. */
     target_img ^= 0x4000;
+    d = &page_dirty[target_img >> 14];
 
     /* Calculate the source address. */
     addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
 
+    /* 
+     * Calculate the bytes to copy from each plane: the columns holding
+     * the changed pixels(four pixels per byte) in each changed row.
+     * Full rows are contiguous, and are copied at once.
+     */
+    start = d->y0 * SCROLL_X_WIDTH + (d->x0 >> 2);
+    width = ((d->x1 + 3) >> 2) - (d->x0 >> 2);
+
     /* Draw to each plane in the video memory. */
     for (i = 0; i < 4; i++) {
         SET_WRITE_MASK(1 << (i + 8));
-        copy_image(addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i), target_img);
+        src = addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i);
+        if (width == SCROLL_X_WIDTH) {
+            copy_image(src + start, target_img + start, 
+                       (d->y1 - d->y0) * SCROLL_X_WIDTH);
+            continue;
+        }
+        for (y = 0; y < d->y1 - d->y0; y++)
+            copy_image(src + start + y * SCROLL_X_WIDTH, 
+                       target_img + start + y * SCROLL_X_WIDTH, width);
     }
 
+    /* The page just filled now matches the build buffer. */
+    d->x0 = SCROLL_X_DIM;
+    d->x1 = 0;
+
     /*
      * Change the VGA registers to point the top left of the screen
      * to the video memory that we just filled.
@@ -538,6 +871,7 @@ void show_screen() {
     OUTW(0x03D4, (target_img & 0xFF00) | 0x0C);
     OUTW(0x03D4, ((target_img & 0x00FF) << 8) | 0x0D);
 }
+#endif /* MODEX_HW_SCROLL */
 
 
 
@@ -549,14 +883,20 @@ void show_screen() {
  *     INPUTS: none
  *     OUTPUTS: none
  *     RETURN VALUE: none
- *     SIDE EFFECTS: fills all 256kB of VGA video memory with zeroes
+ *     SIDE EFFECTS: fills all 256kB of VGA video memory with zeroes; marks
+ *                   the whole screen and status bar dirty
  */
 void clear_screens() {
     /* Write to all four planes at once. */
     SET_WRITE_MASK(0x0F00);
 
     /* Set 64kB to zero(times four planes = 256kB). */
-    memset(mem_image, 0, MODE_X_MEM_SIZE);
+    if (NULL != emu)
+        emu_fill(0, 0, MODE_X_MEM_SIZE);
+    else
+        memset(mem_image, 0, MODE_X_MEM_SIZE);
+    mark_dirty(0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+    status_bar_invalidate();
 }
 
 
@@ -570,6 +910,105 @@ void clear_screens() {
 
 
 
+/*
+ * copy_vert_line
+ *     DESCRIPTION: Copy the graphical image of a vertical map line into
+ *                  the appropriate plane of the build buffer.
+ *     INPUTS: x -- the logical x coordinate of the line
+ *             buf -- image of the line(first pixel at the top of the
+ *                    logical view window)
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: draws into the build buffer; marks the line dirty
+ */
+static void copy_vert_line(int x, const unsigned char* buf) {
+    unsigned char* addr;             /* address of first pixel in build    */
+    int p_off;                       /* offset of plane of first pixel     */
+    int i;                          /* loop index over pixels             */
+
+    /* Calculate starting address in build buffer. */
+    addr = img3 + (x >> shift_2) + show_y * SCROLL_X_WIDTH;
+
+    /* Calculate plane offset of first pixel. */
+    p_off = (num3 - (x & and_3));
+    
+    /* Copy image data into appropriate planes in build buffer. */
+    for (i = 0; i < SCROLL_Y_DIM; i++) 
+    {
+        addr[p_off * SCROLL_SIZE] = buf[i];
+        addr +=SCROLL_X_WIDTH;
+    }
+    mark_dirty(x - show_x, 0, x - show_x + 1, SCROLL_Y_DIM);
+}
+
+
+/*
+ * copy_horiz_line
+ *     DESCRIPTION: Copy the graphical image of a horizontal map line into
+ *                  the planes of the build buffer.  Every fourth pixel
+ *                  of the line goes to the same plane, so the line is
+ *                  split into four images, one per plane, and each is
+ *                  written to its plane as consecutive bytes.  With
+ *                  SSE2, 64 pixels are split at a time.
+ *     INPUTS: y -- the logical y coordinate of the line
+ *             buf -- image of the line(first pixel at the left of the
+ *                    logical view window)
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: draws into the build buffer; marks the line dirty
+ */
+static void copy_horiz_line(int y, const unsigned char* buf) {
+    unsigned char* addr;             /* address of first pixel in build buffer (without plane offset) */
+    unsigned char* dst[4];           /* next address in plane of pixels i, i+1, i+2, i+3               */
+    int i;                           /* loop index over pixels                                        */
+    int m;                           /* index over the four images                                    */
+#ifdef __SSE2__
+    const __m128i low = _mm_set1_epi32(0xFF); /* low byte of each 32-bit lane   */
+    __m128i v[4];                    /* 64 pixels of the line                                         */
+    __m128i a[4];                    /* one of each four of those pixels, one per 32-bit lane         */
+#endif
+
+    /* Calculate starting address in build buffer. */
+    addr = img3 + (show_x >> 2) + y * SCROLL_X_WIDTH;
+
+    /* 
+     * Pixel i + m(for i a multiple of 4) goes to plane offset
+     * 3 - ((show_x + m) & 3), and to the next address after the first
+     * plane wraps around.
+     */
+    for (m = 0; m < 4; m++)
+        dst[m] = addr + (3 - ((show_x + m) & 3)) * SCROLL_SIZE + (((show_x & 3) + m) >> 2);
+
+    i = 0;
+#ifdef __SSE2__
+    for (; i + 64 <= SCROLL_X_DIM; i += 64) {
+        v[0] = _mm_loadu_si128((const __m128i*)(buf + i));
+        v[1] = _mm_loadu_si128((const __m128i*)(buf + i + 16));
+        v[2] = _mm_loadu_si128((const __m128i*)(buf + i + 32));
+        v[3] = _mm_loadu_si128((const __m128i*)(buf + i + 48));
+        for (m = 0; m < 4; m++) {
+            /* Keep byte m of each group of four, then pack them. */
+            a[0] = _mm_and_si128(_mm_srli_epi32(v[0], 8 * m), low);
+            a[1] = _mm_and_si128(_mm_srli_epi32(v[1], 8 * m), low);
+            a[2] = _mm_and_si128(_mm_srli_epi32(v[2], 8 * m), low);
+            a[3] = _mm_and_si128(_mm_srli_epi32(v[3], 8 * m), low);
+            _mm_storeu_si128((__m128i*)dst[m],
+                             _mm_packus_epi16(_mm_packs_epi32(a[0], a[1]),
+                                              _mm_packs_epi32(a[2], a[3])));
+            dst[m] += 16;
+        }
+    }
+#endif
+
+    /* Copy the remaining pixels a group of four at a time. */
+    for (; i < SCROLL_X_DIM; i += 4) {
+        for (m = 0; m < 4 && i + m < SCROLL_X_DIM; m++)
+            *dst[m]++ = buf[i + m];
+    }
+    mark_dirty(0, y - show_y, SCROLL_X_DIM, y - show_y + 1);
+}
+
+
 /*
  * draw_vert_line
  *     DESCRIPTION: Draw a vertical map line into the build buffer. The
@@ -586,9 +1025,6 @@ void clear_screens() {
  */
 int draw_vert_line(int x) {
     unsigned char buf[SCROLL_Y_DIM]; /* buffer for graphical image of line */
-    unsigned char* addr;             /* address of first pixel in build    */
-    int p_off;                       /* offset of plane of first pixel     */
-    int i;                          /* loop index over pixels             */
 
     /* Check whether requested line falls in the logical view window. */
     if (x < 0 || x >= SCROLL_X_DIM)
@@ -597,21 +1033,9 @@ int draw_vert_line(int x) {
     /* Adjust y to the logical row value. */
     x += show_x;
 
-    /* Get the image of the line. */
+    /* Get the image of the line and copy it into the build buffer. */
     (*vert_line_fn) (x, show_y, buf);
-
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (x >> shift_2) + show_y * SCROLL_X_WIDTH;
-
-    /* Calculate plane offset of first pixel. */
-    p_off = (num3 - (x & and_3));
-    
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) 
-    {
-        addr[p_off * SCROLL_SIZE] = buf[i];
-        addr +=SCROLL_X_WIDTH;
-    }
+    copy_vert_line(x, buf);
 
     /* Return success. */
     return 0;
@@ -632,10 +1056,7 @@ int draw_vert_line(int x) {
  *     SIDE EFFECTS: draws into the build buffer
  */
 int draw_horiz_line(int y) {
-    unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of line                            */
-    unsigned char* addr;             /* address of first pixel in build buffer (without plane offset) */
-    int p_off;                       /* offset of plane of first pixel                                */
-    int i;                           /* loop index over pixels                                        */
+    unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of line */
 
     /* Check whether requested line falls in the logical view window. */
     if (y < 0 || y >= SCROLL_Y_DIM)
@@ -644,24 +1065,86 @@ int draw_horiz_line(int y) {
     /* Adjust y to the logical row value. */
     y += show_y;
 
-    /* Get the image of the line. */
+    /* Get the image of the line and copy it into the build buffer. */
     (*horiz_line_fn)(show_x, y, buf);
+    copy_horiz_line(y, buf);
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (show_x >> 2) + y * SCROLL_X_WIDTH;
+    /* Return success. */
+    return 0;
+}
 
-    /* Calculate plane offset of first pixel. */
-    p_off = (3 - (show_x & 3));
 
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_X_DIM; i++) {
-        addr[p_off * SCROLL_SIZE] = buf[i];
-        if (--p_off < 0) {
-            p_off = 3;
-            addr++;
-        }
+/*
+ * draw_vert_lines
+ *     DESCRIPTION: Draw adjacent vertical map lines into the build
+ *                  buffer.  The image of each line is still obtained
+ *                  from the vertical line callback: the rectangle
+ *                  callback's images are stored row by row, and
+ *                  turning a few columns of them back into lines costs
+ *                  more than the calls saved.
+ *     INPUTS: x0 -- the 0-based pixel column number of the leftmost line
+ *                   to be drawn within the logical view window
+ *             n -- number of lines to draw
+ *     OUTPUTS: none
+ *     RETURN VALUE: Returns 0 on success. If any of the lines is outside
+ *                   of the valid SCROLL range, the function returns -1
+ *                   and draws nothing.
+ *     SIDE EFFECTS: draws into the build buffer
+ */
+int draw_vert_lines(int x0, int n) {
+    unsigned char buf[SCROLL_Y_DIM]; /* buffer for graphical image of line */
+    int i;                           /* loop index over lines              */
+
+    /* Check whether requested lines fall in the logical view window. */
+    if (x0 < 0 || n < 0 || x0 + n > SCROLL_X_DIM)
+        return -1;
+
+    /* Get the image of each line and copy it into the build buffer. */
+    for (i = show_x + x0; i < show_x + x0 + n; i++) {
+        (*vert_line_fn) (i, show_y, buf);
+        copy_vert_line(i, buf);
+    }
+
+    /* Return success. */
+    return 0;
+}
+
+
+/*
+ * draw_horiz_lines
+ *     DESCRIPTION: Draw adjacent horizontal map lines into the build
+ *                  buffer, obtaining their image with one call to the
+ *                  rectangle callback(or, without one, a call to the
+ *                  horizontal line callback per line).
+ *     INPUTS: y0 -- the 0-based pixel row number of the top line to be
+ *                   drawn within the logical view window
+ *             n -- number of lines to draw
+ *     OUTPUTS: none
+ *     RETURN VALUE: Returns 0 on success. If any of the lines is outside
+ *                   of the valid SCROLL range, the function returns -1
+ *                   and draws nothing.
+ *     SIDE EFFECTS: draws into the build buffer
+ */
+int draw_horiz_lines(int y0, int n) {
+    int i;                           /* loop index over lines              */
+
+    /* Check whether requested lines fall in the logical view window. */
+    if (y0 < 0 || n < 0 || y0 + n > SCROLL_Y_DIM)
+        return -1;
+
+    if (rect_fn == NULL) {
+        for (i = 0; i < n; i++)
+            (void)draw_horiz_line(y0 + i);
+        return 0;
     }
 
+    /* Get the image of the lines, one row of SCROLL_X_DIM at a time. */
+    if (n > 0)
+        (*rect_fn) (show_x, show_y + y0, SCROLL_X_DIM, n, rect_buf, 
+                    SCROLL_X_DIM);
+    for (i = 0; i < n; i++)
+        copy_horiz_line(show_y + y0 + i, rect_buf + i * SCROLL_X_DIM);
+
     /* Return success. */
     return 0;
 }
@@ -723,6 +1206,15 @@ static void VGA_blank(int blank_bit) {
      */
     blank_bit = ((blank_bit & 1) << 5);
 
+    /* Mirror the port accesses below on the emulated VGA. */
+    if (NULL != emu) {
+        emu_outb(0x03C4, 0x01);
+        emu_outb(0x03C5, (emu_inb(0x03C5) & 0xDF) | blank_bit);
+        (void)emu_inb(0x03DA);
+        emu_outb(0x03C0, 0x20);
+        return;
+    }
+
     asm volatile("                                                      \n\
         movb $0x01, %%al        /* Set sequencer index to 1 */          \n\
         movw $0x03C4, %%dx                                              \n\
@@ -803,6 +1295,9 @@ static void set_CRTC_registers(unsigned short table[NUM_CRTC_REGS]) {
  */
 static void set_attr_registers(unsigned char table[NUM_ATTR_REGS * 2]) {
     /* Reset attribute register to write index next rather than data. */
+    if (NULL != emu)
+        (void)emu_inb(0x03DA);
+    else
     asm volatile("          \n\
         inb (%%dx), %%al    \n\
         "
@@ -960,6 +1455,10 @@ static void write_font_data() {
 
     /* Copy font data from array into video memory. */
     for (i = 0, fonts = mem_image; i < 256; i++) {
+        if (NULL != emu) {
+            emu_write(i * 32, font_data[i], 16);
+            continue;
+        }
         for (j = 0; j < 16; j++) {
             fonts[j] = font_data[i][j];
         }
@@ -986,7 +1485,7 @@ static void write_font_data() {
  *     SIDE EFFECTS: may clear screens; writes font data to video memory
  */
 static void set_text_mode_3(int clear_scr) {
-    unsigned long* txt_scr; /* pointer to text screens in video memory */
+    uint32_t* txt_scr;      /* pointer to text screens in video memory */
     int i;                  /* loop over text screen words             */
 
     VGA_blank(1);           /* blank the screen */
@@ -1002,7 +1501,7 @@ static void set_text_mode_3(int clear_scr) {
     set_graphics_registers(text_graphics);   /* graphics registers      */
     fill_palette_text();                     /* palette colors          */
     if (clear_scr) {                         /* clear screens if needed */
-        txt_scr = (unsigned long*)(mem_image + 0x18000);
+        txt_scr = (uint32_t*)(mem_image + 0x18000);
         for (i = 0; i < 8192; i++) {
             *txt_scr++ = 0x07200720;
         }
@@ -1016,30 +1515,80 @@ static void set_text_mode_3(int clear_scr) {
 
 /*
  * copy_image
- *     DESCRIPTION: Copy one plane of a screen from the build buffer to the video memory.
- *     INPUTS: img -- a pointer to a single screen plane in the build buffer
+ *     DESCRIPTION: Copy part of one plane of a screen from the build buffer to the video memory.
+ *     INPUTS: img -- a pointer to the first byte in a screen plane in the build buffer
  *             scr_addr -- the destination offset in video memory
+ *             len -- number of bytes to copy(at most 16000 - 1440, a whole plane)
  *     OUTPUTS: none
  *     RETURN VALUE: none
- *     SIDE EFFECTS: copies a plane from the build buffer to video memory
+ *     SIDE EFFECTS: copies from the build buffer to video memory
  */
-static void copy_image(unsigned char* img, unsigned short scr_addr) {
+static void copy_image(unsigned char* img, unsigned short scr_addr, int len) {
+    unsigned char* dst = mem_image + scr_addr; /* destination in video memory */
+
     /*
      * memcpy is actually probably good enough here, and is usually
      * implemented using ISA-specific features like those below,
      * but the code herme provides an example of x86 string moves
      */
+    if (NULL != emu) {
+        emu_write(scr_addr, img, len);
+        return;
+    }
     asm volatile("                                                  \n\
         cld                                                         \n\
-        movl $16000-1440, %%ecx                                          \n\
         rep movsb        /* copy ECX bytes from M[ESI] to M[EDI] */ \n\
         "
-        : /* no outputs */
-        : "S"(img), "D"(mem_image + scr_addr)
-        : "eax", "ecx", "memory"
+        : "+S"(img), "+D"(dst), "+c"(len)
+        :
+        : "memory"
     );
 }
 
+#if defined(MODEX_HW_SCROLL)
+/*
+ * copy_rows
+ *     DESCRIPTION: Copy a rectangle of one plane of the screen from the
+ *                  build buffer to the canvas in video memory.  The
+ *                  columns exposed by horizontal scrolling are one or
+ *                  two bytes wide, so the rows are copied by one loop
+ *                  rather than by a call to copy_image for each.
+ *     INPUTS: img -- a pointer to the upper left byte in the build buffer
+ *             scr_addr -- the destination offset of that byte in video
+ *                         memory
+ *             width -- bytes to copy from each row
+ *             rows -- number of rows
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: copies from the build buffer to video memory
+ */
+static void copy_rows(unsigned char* img, unsigned short scr_addr, int width, int rows) {
+    unsigned char* dst;     /* destination in video memory         */
+    int p;                  /* loop index over emulated planes     */
+    int y;                  /* loop index over rows                */
+    int j;                  /* loop index over bytes in a row      */
+
+    if (NULL == emu) {
+        for (y = 0; y < rows; y++)
+            copy_image(img + y * SCROLL_X_WIDTH, scr_addr + y * VID_ROW_BYTES, width);
+        return;
+    }
+
+    /* The canvas never wraps around the end of video memory. */
+    for (p = 0; p < 4; p++) {
+        if (0 == (emu->seq[2] & (1 << p)))
+            continue;
+        dst = emu->planes[p] + scr_addr;
+        for (y = 0; y < rows; y++) {
+            for (j = 0; j < width; j++)
+                dst[j] = img[y * SCROLL_X_WIDTH + j];
+            dst += VID_ROW_BYTES;
+        }
+    }
+}
+#endif
+
+
 /*
  * copy_status
  *     DESCRIPTION: copy status fo reach plane
@@ -1050,6 +1599,17 @@ static void copy_image(unsigned char* img, unsigned short scr_addr) {
  *     SIDE EFFECTS: copies a plane from the build buffer to video memory
  */
 void copy_status (unsigned char* img, unsigned short scr_addr){
+#if defined(MODEX_HW_SCROLL)
+  int y;
+  /* Video memory rows are wider than the status bar. */
+  for (y = 0; y < STATUS_ROWS; y++)
+      copy_image(img + y * SCROLL_X_WIDTH, scr_addr + y * VID_ROW_BYTES,
+                 SCROLL_X_WIDTH);
+#else
+  if (NULL != emu) {
+      emu_write(scr_addr, img, 1440);
+      return;
+  }
   asm volatile (
       "cld                                                 ;"
       "movl $1440,%%ecx                                   ;"
@@ -1058,6 +1618,7 @@ void copy_status (unsigned char* img, unsigned short scr_addr){
     : "S" (img), "D" (mem_image + scr_addr) 
     : "eax", "ecx", "memory"
   );
+#endif
 }
 
 /*
@@ -1078,6 +1639,271 @@ void modex_helper() {
     return;
 }
 
+/*
+ * copy_status_cols
+ *     DESCRIPTION: Copy some columns of the status bar from status_buff
+ *                  to video memory, for each plane.  Used to show the
+ *                  characters of the bar that have changed.
+ *     INPUTS: x0 -- the first byte column(0 to SCROLL_X_WIDTH - 1)
+ *             width -- the number of byte columns
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: copies from status_buff to video memory
+ */
+void copy_status_cols(int x0, int width) {
+    int i;                  /* loop index over planes */
+    int y;                  /* loop index over rows   */
+
+    if (SCROLL_X_WIDTH == width) {
+        modex_helper();
+        return;
+    }
+    for (i = 0; i < plane_num; i++) {
+        SET_WRITE_MASK (1 << (i + shift8));
+        for (y = 0; y < STATUS_ROWS; y++)
+            copy_image(status_buff + i * size1440 + y * SCROLL_X_WIDTH + x0,
+                       y * VID_ROW_BYTES + x0, width);
+    }
+}
+
+
+/*
+ * open_emulated_vga
+ *     DESCRIPTION: Reset the emulated VGA and use it in place of the
+ *                  hardware for all subsequent port and video memory
+ *                  accesses.
+ *     INPUTS: none
+ *     OUTPUTS: none
+ *     RETURN VALUE: 0 on success(cannot fail)
+ *     SIDE EFFECTS: points mem_image at the emulated memory window
+ */
+static int open_emulated_vga() {
+    memset(&emu_state, 0, sizeof (emu_state));
+    emu = &emu_state;
+    mem_image = emu_window;
+    return 0;
+}
+
+
+/*
+ * emu_outb
+ *     DESCRIPTION: Write a byte to a port of the emulated VGA.  Index
+ *                  ports select a register; data ports write the selected
+ *                  register.  The attribute controller uses a single port
+ *                  with a flip-flop, and the DAC auto-increments through
+ *                  the red, green, and blue components of each color.
+ *     INPUTS: port -- the I/O port
+ *             val -- the byte written
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: changes emulated register state
+ */
+static void emu_outb(unsigned short port, unsigned char val) {
+    switch (port) {
+        case 0x03C0:
+            if (emu->attr_data_next) {
+                if (emu->attr_idx < NUM_ATTR_REGS)
+                    emu->attr[emu->attr_idx] = val;
+            }
+            else {
+                /* bit 5 (palette address source) is not modeled */
+                emu->attr_idx = (val & 0x1F);
+            }
+            emu->attr_data_next ^= 1;
+            break;
+        case 0x03C2: emu->misc = val; break;
+        case 0x03C4: emu->seq_idx = val; break;
+        case 0x03C5:
+            if (emu->seq_idx < NUM_SEQUENCER_REGS)
+                emu->seq[emu->seq_idx] = val;
+            break;
+        case 0x03C8:
+            emu->dac_idx = val;
+            emu->dac_rgb = 0;
+            break;
+        case 0x03C9:
+            emu->dac[emu->dac_idx][emu->dac_rgb] = (val & 0x3F);
+            if (3 == ++emu->dac_rgb) {
+                emu->dac_rgb = 0;
+                emu->dac_idx++;
+            }
+            break;
+        case 0x03CE: emu->graphics_idx = val; break;
+        case 0x03CF:
+            if (emu->graphics_idx < NUM_GRAPHICS_REGS)
+                emu->graphics[emu->graphics_idx] = val;
+            break;
+        case 0x03D4: emu->crtc_idx = val; break;
+        case 0x03D5:
+            /* Registers 0-7 are write-protected by bit 7 of register 0x11. */
+            if (emu->crtc_idx < NUM_CRTC_REGS &&
+                (emu->crtc_idx > 7 || 0 == (emu->crtc[0x11] & 0x80)))
+                emu->crtc[emu->crtc_idx] = val;
+            break;
+        default: break;
+    }
+}
+
+
+/*
+ * emu_outw
+ *     DESCRIPTION: Write two bytes to two consecutive ports of the emulated
+ *                  VGA(low byte to port, high byte to port + 1), as OUTW
+ *                  does for an index/data register pair.
+ *     INPUTS: port -- the first I/O port
+ *             val -- the two bytes written
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: changes emulated register state
+ */
+static void emu_outw(unsigned short port, unsigned short val) {
+    emu_outb(port, val & 0xFF);
+    emu_outb(port + 1, val >> 8);
+}
+
+
+/*
+ * emu_inb
+ *     DESCRIPTION: Read a byte from a port of the emulated VGA.  Reading
+ *                  input status register 1 resets the attribute flip-flop.
+ *     INPUTS: port -- the I/O port
+ *     OUTPUTS: none
+ *     RETURN VALUE: the byte read(0 for ports that are not modeled)
+ *     SIDE EFFECTS: may reset the attribute controller flip-flop
+ */
+static unsigned char emu_inb(unsigned short port) {
+    switch (port) {
+        case 0x03C5:
+            return (emu->seq_idx < NUM_SEQUENCER_REGS ? emu->seq[emu->seq_idx] : 0);
+        case 0x03DA:
+            emu->attr_data_next = 0;
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+
+/*
+ * emu_write
+ *     DESCRIPTION: Write a block of bytes to emulated video memory.  Each
+ *                  byte is written to every plane enabled in the sequencer
+ *                  map mask, as on the real VGA.
+ *     INPUTS: scr_addr -- the destination offset in video memory
+ *             src -- the bytes to be written
+ *             len -- the number of bytes
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: changes emulated video memory
+ */
+static void emu_write(unsigned short scr_addr, const unsigned char* src, int len) {
+    int p;  /* loop index over planes */
+    int n;  /* bytes before wrapping  */
+
+    for (p = 0; p < 4; p++) {
+        if (0 == (emu->seq[2] & (1 << p)))
+            continue;
+        n = MODE_X_MEM_SIZE - scr_addr;
+        if (n >= len) {
+            memcpy(emu->planes[p] + scr_addr, src, len);
+        }
+        else {
+            memcpy(emu->planes[p] + scr_addr, src, n);
+            memcpy(emu->planes[p], src + n, len - n);
+        }
+    }
+}
+
+
+/*
+ * emu_fill
+ *     DESCRIPTION: Fill a block of emulated video memory with a value in
+ *                  every plane enabled in the sequencer map mask.
+ *     INPUTS: scr_addr -- the destination offset in video memory
+ *             val -- the value to be written
+ *             len -- the number of bytes(at most MODE_X_MEM_SIZE)
+ *     OUTPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: changes emulated video memory
+ */
+static void emu_fill(unsigned short scr_addr, unsigned char val, int len) {
+    int p;  /* loop index over planes */
+    int n;  /* bytes before wrapping  */
+
+    for (p = 0; p < 4; p++) {
+        if (0 == (emu->seq[2] & (1 << p)))
+            continue;
+        n = MODE_X_MEM_SIZE - scr_addr;
+        if (n >= len) {
+            memset(emu->planes[p] + scr_addr, val, len);
+        }
+        else {
+            memset(emu->planes[p] + scr_addr, val, n);
+            memset(emu->planes[p], val, len - n);
+        }
+    }
+}
+
+
+/*
+ * vga_emulator
+ *     DESCRIPTION: Get the state of the emulated VGA, e.g., to check what
+ *                  a benchmark or test drew.
+ *     INPUTS: none
+ *     OUTPUTS: none
+ *     RETURN VALUE: pointer to the emulated VGA state, or NULL if mode X
+ *                   was set up with the hardware backend
+ *     SIDE EFFECTS: none
+ */
+const vga_emu_t* vga_emulator() {
+    return emu;
+}
+
+
+/*
+ * vga_emu_pixel
+ *     DESCRIPTION: Get the color index that the emulated VGA displays at
+ *                  a given screen pixel.  The calculation follows the
+ *                  registers as the hardware would: the CRTC start address,
+ *                  offset(line width), and line compare(split screen for
+ *                  the status bar), the maximum scan line(row doubling),
+ *                  and the attribute controller's horizontal pel panning.
+ *     INPUTS: (x,y) -- the screen pixel, with y counting rows of pixels
+ *                      from the top of the screen(status bar rows follow
+ *                      the scrolling region)
+ *     OUTPUTS: none
+ *     RETURN VALUE: the color index at (x,y), or 0 without an emulated VGA
+ *     SIDE EFFECTS: none
+ */
+unsigned char vga_emu_pixel(int x, int y) {
+    unsigned int start;     /* address of upper left pixel         */
+    unsigned int stride;    /* bytes per line                      */
+    unsigned int split;     /* first row shown from address 0      */
+    unsigned int pan;       /* horizontal pel panning in pixels    */
+    unsigned int addr;      /* address of the pixel in its plane   */
+
+    if (NULL == emu)
+        return 0;
+
+    start = (emu->crtc[0x0C] << 8) | emu->crtc[0x0D];
+    stride = emu->crtc[0x13] * 2;
+    split = (emu->crtc[0x18] | ((emu->crtc[0x07] & 0x10) << 4) |
+             ((emu->crtc[0x09] & 0x40) << 3)) + 1;
+    split /= (emu->crtc[0x09] & 0x1F) + 1;
+    pan = (emu->attr[0x13] >> 1) & 3;
+
+    /* Bit 5 of the attribute mode control register stops the split panning. */
+    if ((unsigned int)y >= split) {
+        y -= split;
+        start = 0;
+        if (emu->attr[0x10] & 0x20)
+            pan = 0;
+    }
+    x += pan;
+    addr = (start + y * stride + (x >> 2)) & (MODE_X_MEM_SIZE - 1);
+    return emu->planes[x & 3][addr];
+}
+
 
 #ifdef TEXT_RESTORE_PROGRAM
 
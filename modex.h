@@ -66,6 +66,13 @@
 #define size1440        1440                //size of each plane
 #define ADDITIONAL_PALETTE_SIZE     192     //size of additionla palette
 
+/* Mode X and general VGA parameters */
+#define MODE_X_MEM_SIZE     65536   /* bytes in each of the four planes */
+#define NUM_SEQUENCER_REGS      5
+#define NUM_CRTC_REGS          25
+#define NUM_GRAPHICS_REGS       9
+#define NUM_ATTR_REGS          22
+
 /*
  * NOTES
  *
@@ -117,9 +124,49 @@
  * is drawn. Other data are left untouched in most cases.
  */
 
+/*
+ * Display backends.  VGA_HARDWARE programs the real VGA through its I/O
+ * ports and /dev/mem, and so needs root on a machine (or VM) with a VGA.
+ * VGA_EMULATED sends the same port writes and video memory writes to a
+ * software model of the adapter, which lets the renderer run (and be
+ * timed) on machines without VGA access.
+ */
+typedef enum {
+    VGA_HARDWARE,
+    VGA_EMULATED
+} vga_backend_t;
+
+/*
+ * State of the emulated VGA.  Only the parts of the adapter used by this
+ * program are modeled: the four planes of video memory, the sequencer
+ * (including the map mask used to select planes for writes), the CRTC
+ * (start address, offset, line compare), the attribute controller (pel
+ * panning), the graphics controller, and the DAC palette.  Register values
+ * are recorded exactly as written through the ports.
+ */
+typedef struct vga_emu_t vga_emu_t;
+struct vga_emu_t {
+    unsigned char planes[4][MODE_X_MEM_SIZE];  /* video memory, by plane  */
+    unsigned char seq[NUM_SEQUENCER_REGS];     /* sequencer registers     */
+    unsigned char seq_idx;                     /* selected seq. register  */
+    unsigned char crtc[NUM_CRTC_REGS];         /* CRT controller regs     */
+    unsigned char crtc_idx;                    /* selected CRTC register  */
+    unsigned char attr[NUM_ATTR_REGS];         /* attribute registers     */
+    unsigned char attr_idx;                    /* selected attr. register */
+    unsigned char attr_data_next;              /* 0x3C0 flip-flop state   */
+    unsigned char graphics[NUM_GRAPHICS_REGS]; /* graphics registers      */
+    unsigned char graphics_idx;                /* selected graphics reg.  */
+    unsigned char misc;                        /* misc. output register   */
+    unsigned char dac[256][3];                 /* 6-bit RGB palette       */
+    unsigned char dac_idx;                     /* DAC write color index   */
+    unsigned char dac_rgb;                     /* next component (0-2)    */
+};
+
 /* configure VGA for mode X; initializes logical view to (0, 0) */
 extern int set_mode_X(void(*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
-                      void(*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM]));
+                      void(*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM]),
+                      void(*rect_fill_fn)(int, int, int, int, unsigned char*, int),
+                      vga_backend_t backend);
 
 /* return to text mode */
 extern void clear_mode_X();
@@ -139,8 +186,23 @@ extern int draw_horiz_line(int y);
 /* draw a vertical line at horizontal pixel x within the logical view window */
 extern int draw_vert_line(int x);
 
+/* draw n horizontal lines starting at vertical pixel y0 within the view */
+extern int draw_horiz_lines(int y0, int n);
+
+/* draw n vertical lines starting at horizontal pixel x0 within the view */
+extern int draw_vert_lines(int x0, int n);
+
 extern void modex_helper();
 
+/* copy byte columns x0 to x0 + width - 1 of the status bar to the screen */
+extern void copy_status_cols(int x0, int width);
+
+/* get the emulated VGA state (NULL when using the hardware backend) */
+extern const vga_emu_t* vga_emulator();
+
+/* get the color index displayed at screen pixel (x,y) by the emulated VGA */
+extern unsigned char vga_emu_pixel(int x, int y);
+
 void copy_status (unsigned char* img, unsigned short scr_addr);
 
 #endif /* MODEX_H */
@@ -45,6 +45,16 @@
  * The output file format is 5:6:5 RGB stored in the same order as in the
  * BMP, i.e., rows from bottom to top, and from right to left within each
  * row.  The header simply gives the dimensions of the image.
+ *
+ * With -q, a room photo is instead written precompiled: the palette is
+ * selected and the pixels mapped into it here(link with quantize.c),
+ * so that the game can load the photo without quantizing it.  See
+ * photo_headers.h for the format.
+ *
+ * With -p, the program instead builds an asset pack from room photo and
+ * object image files already produced by this program, for example:
+ *     mp2photo -p images/world.pack images/allerton.photo images/tux.obj ...
+ * Assets are named in the pack by the file names given.
  */
 
 
@@ -53,7 +63,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "photo.h"
 #include "photo_headers.h"
+#include "quantize.h"
 
 
 #ifndef WRITE_OBJECT_IMAGE
@@ -96,6 +108,18 @@ static int bmp_header_check(const char* fname, FILE* in, bmp_header_t* h) {
     return 1;
 }
 
+// Checks that a BMP can be precompiled into a room photo that the game
+// can load(which also keeps it within the limits of the quantizer).
+// Returns 1 if it can, otherwise 0.
+static int room_photo_size_check(const char* fname, const bmp_header_t* h) {
+    if (MAX_PHOTO_WIDTH < h->img_width || MAX_PHOTO_HEIGHT < h->img_height) {
+        fprintf(stderr, "%s is larger than a room photo can be(%dx%d).\n",
+                fname, MAX_PHOTO_WIDTH, MAX_PHOTO_HEIGHT);
+        return 0;
+    }
+    return 1;
+}
+
 // Read image data from BMP file into dynamically allocated memory.
 // Return pointer to memory on success, or NULL on failure.
 static uint8_t* read_bmp_image_data(FILE* in, const bmp_header_t* h) {
@@ -169,18 +193,241 @@ static int write_output_file(FILE* out, const bmp_header_t* h, const uint8_t* im
     return 1;
 }
 
+// Write a precompiled room photo: the magic sequence and header, the
+// palette, and one palette color byte per pixel, with rows from top to
+// bottom.  Return 1 on success, 0 on failure.
+static int write_precompiled_file(FILE* out, const bmp_header_t* h, const uint8_t* img) {
+    photo_precomp_header_t pre;
+    quantizer_t* q;
+    uint16_t* pixels;
+    uint8_t* lut;
+    uint8_t* indexed;
+    uint32_t n_pixels;
+    uint32_t row_width;
+    uint16_t x;
+    uint16_t y;
+    const uint8_t* src;
+    int written;
+
+    // Allocate space for the 5:6:5 pixels, the result, and the quantizer.
+    n_pixels = h->img_width * h->img_height;
+    q = malloc(sizeof (*q));
+    pixels = malloc(n_pixels * sizeof (pixels[0]));
+    lut = malloc(QUANT_LUT_SIZE);
+    indexed = malloc(n_pixels);
+    if (NULL == q || NULL == pixels || NULL == lut || NULL == indexed) {
+        perror("allocate space for quantization");
+        free(q);
+        free(pixels);
+        free(lut);
+        free(indexed);
+        return 0;
+    }
+
+    // Convert to 5:6:5 RGB, turning the image right side up, and quantize.
+    row_width = bmp_row_width(h);
+    for (y = 0; h->img_height > y; y++) {
+        for (x = 0; h->img_width > x; x++) {
+            src = img + row_width * y + 3 * x;
+            pixels[h->img_width * (h->img_height - 1 - y) + x] =
+            ((src[2] >> 3) << 11) | ((src[1] >> 2) << 5) | (src[0] >> 3);
+        }
+    }
+    quantize_pixels(q, pixels, n_pixels, pre.palette, lut, indexed);
+
+    // Write header, palette, and pixels to output file.
+    memcpy(pre.magic, PHOTO_PRECOMP_MAGIC, sizeof (pre.magic));
+    pre.hdr.width = h->img_width;
+    pre.hdr.height = h->img_height;
+    written = (1 == fwrite(&pre, sizeof (pre), 1, out) &&
+               n_pixels == fwrite(indexed, 1, n_pixels, out));
+    if (!written) {
+        perror("write precompiled photo to output file");
+    }
+
+    free(q);
+    free(pixels);
+    free(lut);
+    free(indexed);
+    return written;
+}
+
+// Pack asset with its name and table of contents entry.
+typedef struct {
+    asset_pack_entry_t entry;
+    uint8_t* data;
+} pack_asset_t;
+
+// Compare two pack assets by name(for qsort).
+static int compare_pack_assets(const void* a, const void* b) {
+    return strcmp(((const pack_asset_t*)a)->entry.name,
+                  ((const pack_asset_t*)b)->entry.name);
+}
+
+// Read a whole asset file into dynamically allocated memory and turn
+// room photo and object image rows right side up.  The kind of file is
+// recognized by its length: one or two bytes per pixel after the
+// header.  Precompiled photos are already top down and are left alone.
+// Return 1 on success, 0 on failure.
+static int read_pack_asset(const char* fname, pack_asset_t* a) {
+    FILE* in;
+    long len;
+    photo_header_t h;
+    uint32_t row_len;
+    uint8_t* row;
+    uint8_t* top;
+    uint8_t* bottom;
+
+    if (ASSET_NAME_LEN <= strlen(fname)) {
+        fprintf(stderr, "%s: name too long for asset pack.\n", fname);
+        return 0;
+    }
+    strcpy(a->entry.name, fname);
+    if (NULL == (in = fopen(fname, "rb")) ||
+        0 != fseek(in, 0, SEEK_END) || 0 > (len = ftell(in)) ||
+        0 != fseek(in, 0, SEEK_SET) ||
+        NULL == (a->data = malloc(len + 1)) ||
+        (0 < len && 1 != fread(a->data, len, 1, in))) {
+        perror(fname);
+        if (NULL != in) {
+            fclose(in);
+        }
+        return 0;
+    }
+    fclose(in);
+    a->entry.length = len;
+
+    // Flip rows of room photos and object images.
+    if (sizeof (h) > (size_t)len ||
+        0 == memcmp(a->data, PHOTO_PRECOMP_MAGIC, sizeof (h))) {
+        return 1;
+    }
+    memcpy(&h, a->data, sizeof (h));
+    if (0 == h.height) {
+        return 1;
+    }
+    if ((size_t)len == sizeof (h) + (uint32_t)h.width * h.height) {
+        row_len = h.width;
+    } else if ((size_t)len == sizeof (h) + 2 * (uint32_t)h.width * h.height) {
+        row_len = 2 * h.width;
+    } else {
+        return 1;
+    }
+    if (NULL == (row = malloc(row_len + 1))) {
+        perror("allocate row");
+        return 0;
+    }
+    top = a->data + sizeof (h);
+    bottom = top + row_len * (h.height - 1);
+    for (; top < bottom; top += row_len, bottom -= row_len) {
+        memcpy(row, top, row_len);
+        memcpy(top, bottom, row_len);
+        memcpy(bottom, row, row_len);
+    }
+    free(row);
+    a->entry.flags = ASSET_TOP_DOWN;
+    return 1;
+}
+
+// Build an asset pack(see photo_headers.h) from asset files.  Return 1
+// on success, 0 on failure.
+static int write_asset_pack(FILE* out, int n_files, char* files[]) {
+    static const uint8_t zeros[ASSET_ALIGN];
+    asset_pack_header_t hdr;
+    pack_asset_t* assets;
+    uint32_t offset;
+    uint32_t pad;
+    int written;
+    int i;
+
+    // Read the assets, then put them in order by name.
+    if (NULL == (assets = calloc(n_files, sizeof (assets[0])))) {
+        perror("allocate asset table");
+        return 0;
+    }
+    written = 1;
+    for (i = 0; n_files > i && written; i++) {
+        written = read_pack_asset(files[i], &assets[i]);
+    }
+    if (written) {
+        qsort(assets, n_files, sizeof (assets[0]), compare_pack_assets);
+        for (i = 1; n_files > i; i++) {
+            if (0 == strcmp(assets[i - 1].entry.name, assets[i].entry.name)) {
+                fprintf(stderr, "%s appears twice.\n", assets[i].entry.name);
+                written = 0;
+            }
+        }
+    }
+
+    // Place the assets after the table of contents, then write it all.
+    if (written) {
+        memcpy(hdr.magic, ASSET_PACK_MAGIC, sizeof (hdr.magic));
+        hdr.n_entries = n_files;
+        hdr.reserved = 0;
+        offset = sizeof (hdr) + n_files * sizeof (assets[0].entry);
+        for (i = 0; n_files > i; i++) {
+            offset = (offset + ASSET_ALIGN - 1) & ~(ASSET_ALIGN - 1);
+            assets[i].entry.offset = offset;
+            offset += assets[i].entry.length;
+        }
+        written = (1 == fwrite(&hdr, sizeof (hdr), 1, out));
+        for (i = 0; n_files > i && written; i++) {
+            written = (1 == fwrite(&assets[i].entry, sizeof (assets[i].entry), 1, out));
+        }
+        offset = sizeof (hdr) + n_files * sizeof (assets[0].entry);
+        for (i = 0; n_files > i && written; i++) {
+            pad = assets[i].entry.offset - offset;
+            written = (pad == fwrite(zeros, 1, pad, out) &&
+                       assets[i].entry.length ==
+                       fwrite(assets[i].data, 1, assets[i].entry.length, out));
+            offset = assets[i].entry.offset + assets[i].entry.length;
+        }
+        if (!written) {
+            perror("write asset pack");
+        }
+    }
+
+    for (i = 0; n_files > i; i++) {
+        free(assets[i].data);
+    }
+    free(assets);
+    return written;
+}
+
 int main(int argc, char* argv[]) {
     FILE*        in;
     FILE*        out;
     bmp_header_t bmp_header;
     uint8_t*     img_data;
     int32_t      written;
+    int          precompile;
+
+    // Build an asset pack instead if asked.
+    if (3 < argc && 0 == strcmp(argv[1], "-p")) {
+        if (NULL == (out = fopen(argv[2], "w+b"))) {
+            perror("open asset pack");
+            return 2;
+        }
+        written = write_asset_pack(out, argc - 3, argv + 3);
+        if (EOF == fclose(out)) {
+            perror("close asset pack");
+            written = 0;
+        }
+        return (written ? 0 : 3);
+    }
 
-    // Check syntax of invocation.
-    if (3 != argc) {
+    // Check syntax of invocation(-q is only meaningful for room photos).
+    precompile = (4 == argc && 0 == strcmp(argv[1], "-q"));
+    if ((3 != argc && !precompile) || (precompile && 1 == WRITE_OBJECT_IMAGE)) {
+#if (1 == WRITE_OBJECT_IMAGE)
         fprintf(stderr, "usage: %s <BMP file name> <output file>\n", argv[0]);
+#else
+        fprintf(stderr, "usage: %s [-q] <BMP file name> <output file>\n", argv[0]);
+#endif
+        fprintf(stderr, "       %s -p <asset pack> <asset file>...\n", argv[0]);
         return 2;
     }
+    argv += precompile;
 
     // Try to open the two files.
     if (NULL == (in = fopen(argv[1], "r+b"))) {
@@ -195,6 +442,7 @@ int main(int argc, char* argv[]) {
 
     // Check validity of input file, then read image data from input file.
     if (!bmp_header_check(argv[1], in, &bmp_header) ||
+        (precompile && !room_photo_size_check(argv[1], &bmp_header)) ||
         NULL == (img_data = read_bmp_image_data(in, &bmp_header))) {
         fclose(in);
         fclose(out);
@@ -205,7 +453,11 @@ int main(int argc, char* argv[]) {
     (void)fclose(in);
 
     // Try to write, then close, the output file.
-    written = write_output_file(out, &bmp_header, img_data);
+    if (precompile) {
+        written = write_precompiled_file(out, &bmp_header, img_data);
+    } else {
+        written = write_output_file(out, &bmp_header, img_data);
+    }
     if (EOF == fclose(out)) {
         perror("close output file");
         written = 0;
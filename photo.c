@@ -36,7 +36,12 @@
  */
 
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "modex.h"
@@ -53,12 +58,49 @@
  * well as the code that sets up the VGA to make use of these colors.
  * Pixel data are stored as one-byte values starting from the upper
  * left and traversing the top row before returning to the left of
- * the second row, and so forth.  No padding should be used.
+ * the second row, and so forth.  No padding should be used.  The pixels
+ * of a precompiled photo in the asset pack are read where they lie in
+ * the pack(and so must not be written or freed).
+ *
+ * Vertical lines are drawn from a copy of the pixels stored column by
+ * column(col_img), so that each line is read from consecutive bytes.
+ * The copy is made the first time that a vertical line of the photo is
+ * drawn(see transpose_photo), within a memory budget.
+ *
+ * When compiled with PHOTO_TILED_LAYOUT, the pixels are instead stored
+ * in square tiles(see tile_photo) once loaded, and both horizontal and
+ * vertical lines are read from the tiles; img is then NULL.
  */
 struct photo_t {
     photo_header_t hdr;         /* defines height and width */
     uint8_t        palette[192][3];     /* optimized palette colors */
     uint8_t*       img;                 /* pixel data               */
+    uint8_t*       lut;                 /* 5:6:5 pixel to palette,
+                                           kept only for models     */
+    photo_t*       model;               /* photo sharing palette    */
+    int32_t        is_model;            /* others share palette?    */
+    const char*    fname;               /* file name(not copied)    */
+    int32_t        precompiled;         /* file already quantized?  */
+    int32_t        state;               /* PHOTO_PENDING, etc.      */
+    pthread_mutex_t lock;               /* protects state           */
+    pthread_cond_t  loaded;             /* signaled when state ends */
+    uint8_t*       col_img;             /* pixels, column by column */
+    photo_t*       next_transposed;     /* next photo with col_img  */
+    uint8_t*       tiles;               /* pixels, tile by tile     */
+};
+
+/*
+ * Room photos are opened(header only) when the world is built, and the
+ * pixel data are decoded and quantized later by load_photo, either on a
+ * loader thread or on the first call to prep_room.  The state records
+ * progress; palette and img may only be used once the state is
+ * PHOTO_READY.
+ */
+enum {
+    PHOTO_PENDING,  /* header read; pixels not yet loaded  */
+    PHOTO_LOADING,  /* a thread is loading the pixels      */
+    PHOTO_READY,    /* palette and pixels are valid        */
+    PHOTO_FAILED    /* pixels could not be loaded          */
 };
 
 /* 
@@ -68,11 +110,42 @@ struct photo_t {
  * transparent pixels (value OBJ_CLR_TRANSP).  As with the room photos, 
  * pixel data are stored as one-byte values starting from the upper 
  * left and traversing the top row before returning to the left of the 
- * second row, and so forth.  No padding is used.
+ * second row, and so forth.  No padding is used.  Top-down images in
+ * the asset pack are read where they lie in the pack.
+ *
+ * So that objects can be drawn without testing each pixel, the opaque
+ * pixels of each row and of each column are also listed as runs when
+ * the image is read(see build_image_runs).  The runs of row y are
+ * runs[row_first[y]] through runs[row_first[y + 1] - 1], and those of
+ * column x are runs[col_first[x]] through runs[col_first[x + 1] - 1].
+ * A copy of the pixels stored column by column(col_img) lets the
+ * column runs be copied whole as well.
  */
+typedef struct image_run_t image_run_t;
+struct image_run_t {
+    uint8_t start;                      /* first opaque pixel       */
+    uint8_t len;                        /* number of opaque pixels  */
+};
+
 struct image_t {
     photo_header_t hdr;         /* defines height and width */
     uint8_t*       img;                 /* pixel data               */
+    uint8_t*       col_img;             /* pixels, column by column */
+    uint16_t*      row_first;           /* first run of each row    */
+    uint16_t*      col_first;           /* first run of each column */
+    image_run_t*   runs;                /* opaque runs              */
+};
+
+/*
+ * The contents of an asset(room photo or object image file), either
+ * found in the asset pack or mapped from a file of its own.
+ */
+typedef struct asset_t asset_t;
+struct asset_t {
+    const uint8_t* data;    /* contents                         */
+    size_t         len;     /* length in bytes                  */
+    uint32_t       flags;   /* ASSET_* flags(see photo_headers.h) */
+    int32_t        in_pack; /* 1 if part of the asset pack      */
 };
 
 
@@ -87,31 +160,93 @@ struct image_t {
  */
 static const room_t* cur_room = NULL; 
 
-//struct for level 4
-struct octree_node_level4 {
-        uint16_t    idx_original;
-        uint16_t    idx_level_2;
-        unsigned long int   red_sum;
-        unsigned long int   green_sum;
-        unsigned long int   blue_sum;
-        unsigned int pixel_number;
-        uint16_t    palette_idx;
-        unsigned long int   red_average;
-        unsigned long int   green_average;
-        unsigned long int   blue_average;
-};
+/*
+ * Column-by-column copies of room photos(see transpose_photo) together
+ * take at most PHOTO_TRANSPOSE_BUDGET bytes; copies of other photos are
+ * freed to make room for the current one, and photos larger than the
+ * budget are drawn from their rows.  A budget of 0 disables the copies.
+ * Only the thread that draws the screen uses these variables.
+ */
+#ifndef PHOTO_TRANSPOSE_BUDGET
+#define PHOTO_TRANSPOSE_BUDGET (4 * 1024 * 1024)
+#endif
+static photo_t* transposed = NULL;      /* photos with copies, newest first */
+static size_t   transposed_bytes = 0;   /* memory used by copies            */
+static size_t   transposed_peak = 0;    /* most memory ever used by copies  */
+static uint32_t transposed_built = 0;   /* copies made                      */
+static uint32_t transposed_evicted = 0; /* copies freed to make room        */
 
-//struct for level 2
-struct octree_node_level2 {
-        unsigned long int   red_sum;
-        unsigned long int   green_sum;
-        unsigned long int   blue_sum;
-        unsigned int pixel_number;
-        uint16_t    palette_idx;
-        unsigned long int   red_average;
-        unsigned long int   green_average;
-        unsigned long int   blue_average;
+/*
+ * Tiled room photos(PHOTO_TILED_LAYOUT) are stored as square tiles of
+ * PHOTO_TILE_DIM by PHOTO_TILE_DIM pixels.  The tiles are stored left to
+ * right and then top to bottom, each as consecutive rows of pixels, and
+ * partial tiles at the right and bottom edges are padded with zeroes.
+ * Pixel (x,y) is thus at
+ *
+ *     (((y >> SHIFT) * TILES_PER_ROW + (x >> SHIFT)) << (2 * SHIFT)) +
+ *     ((y & MASK) << SHIFT) + (x & MASK)
+ *
+ * so that a line crossing a tile stays within a few kB of memory in
+ * either direction.
+ */
+#ifndef PHOTO_TILE_SHIFT
+#define PHOTO_TILE_SHIFT 5
+#endif
+#define PHOTO_TILE_DIM   (1 << PHOTO_TILE_SHIFT)
+#define PHOTO_TILE_MASK  (PHOTO_TILE_DIM - 1)
+#define PHOTO_TILE_SIZE  (PHOTO_TILE_DIM * PHOTO_TILE_DIM)
+
+/*
+ * The asset pack, mapped once by open_asset_pack and never unmapped, so
+ * that photos and images can keep pointers into it.  Assets not found
+ * in the pack are read from their own files.
+ */
+static const uint8_t*            pack_map = NULL;  /* whole pack         */
+static size_t                    pack_len = 0;     /* pack length        */
+static const asset_pack_entry_t* pack_toc = NULL;  /* table of contents  */
+static uint32_t                  pack_n_entries = 0; /* entries in table */
+
+/* local functions--see function headers for details */
+static int32_t quantize_photo (photo_t* p, photo_ctx_t* ctx);
+static int32_t read_precompiled_photo (photo_t* p);
+static const uint8_t* map_file (const char* fname, size_t* len);
+static int32_t get_asset (const char* fname, asset_t* a);
+static void put_asset (asset_t* a);
+static int compare_asset_name (const void* key, const void* entry);
+static int32_t build_image_runs (image_t* im);
+static const uint8_t* transpose_photo (photo_t* p);
+#if defined(PHOTO_TILED_LAYOUT) || defined(PHOTO_BENCHMARK_PROGRAM)
+static int32_t tile_photo (photo_t* p);
+#endif
+static void read_photo_row (const photo_t* p, int32_t x, int32_t y, 
+                            uint8_t* buf, int32_t len);
+static void read_photo_col (const photo_t* p, int32_t x, int32_t y, 
+                            uint8_t* buf, int32_t len);
+static int32_t in_asset_pack (const void* ptr);
+static void draw_image_row (const image_t* im, int32_t imgy, int32_t dx, 
+                            uint8_t* buf, int32_t len);
+static void draw_image_col (const image_t* im, int32_t imgx, int32_t dy, 
+                            uint8_t* buf, int32_t len);
+static void* read_image_file (const char* fname, photo_header_t* hdr,
+                              uint32_t pixel_size, uint32_t max_width,
+                              uint32_t max_height, void* buf);
+
+/*
+ * A photo decoding context: scratch space for quantize_photo, sized for
+ * the largest photo so that it can be reused for every photo.  Only one
+ * thread may use a context at a time; each loader thread creates its
+ * own, and other callers share default_ctx(protected by
+ * default_ctx_lock).  Keeping this space off the stack bounds stack use
+ * no matter how large the photo.
+ */
+struct photo_ctx_t {
+    uint16_t pixels[MAX_PHOTO_WIDTH * MAX_PHOTO_HEIGHT]; /* 5:6:5 pixels  */
+    quantizer_t q;                       /* octree scratch space          */
+    uint8_t lut[QUANT_LUT_SIZE];         /* table for photos not models   */
 };
+
+static photo_ctx_t default_ctx;         /* context used without one given */
+static pthread_mutex_t default_ctx_lock = PTHREAD_MUTEX_INITIALIZER;
     
     
 /* 
@@ -132,62 +267,30 @@ struct octree_node_level2 {
 void
 fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 {
-    int            idx;   /* loop index over pixels in the line          */ 
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgx;  /* loop index over pixels in object image      */ 
-    int            yoff;  /* y offset into object image                  */ 
-    uint8_t        pixel; /* pixel from object image                     */
-    const photo_t* view;  /* room photo                                  */
+    const obj_span_t* const* row; /* objects crossing the line           */
+    int32_t        n_objs; /* number of objects crossing the line        */
+    int32_t        i;     /* loop index over objects crossing the line   */
     int32_t        obj_x; /* object x position                           */
     int32_t        obj_y; /* object y position                           */
     const image_t* img;   /* object image                                */
 
-    /* Get pointer to current photo of current room. */
-    view = room_photo (cur_room);
-
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_X_DIM; idx++) {
-        buf[idx] = (0 <= x + idx && view->hdr.width > x + idx ?
-            view->img[view->hdr.width * y + x + idx] : 0);
-    }
+    /* Read the line from the current photo of the current room. */
+    read_photo_row (room_photo (cur_room), x, y, buf, SCROLL_X_DIM);
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-         obj = obj_next (obj)) {
-    obj_x = obj_get_x (obj);
-    obj_y = obj_get_y (obj);
-    img = obj_image (obj);
+    /* Loop over the objects that cross the line(see room_row_objects). */
+    n_objs = room_row_objects (cur_room, y, &row);
+    for (i = 0; n_objs > i; i++) {
+    obj_x = row[i]->x;
+    obj_y = row[i]->y;
+    img = row[i]->img;
 
         /* Is object outside of the line we're drawing? */
-    if (y < obj_y || y >= obj_y + img->hdr.height ||
-        x + SCROLL_X_DIM <= obj_x || x >= obj_x + img->hdr.width) {
+    if (x + SCROLL_X_DIM <= obj_x || x >= obj_x + img->hdr.width) {
         continue;
     }
 
-    /* The y offset of drawing is fixed. */
-    yoff = (y - obj_y) * img->hdr.width;
-
-    /* 
-     * The x offsets depend on whether the object starts to the left
-     * or to the right of the starting point for the line being drawn.
-     */
-    if (x <= obj_x) {
-        idx = obj_x - x;
-        imgx = 0;
-    } else {
-        idx = 0;
-        imgx = x - obj_x;
-    }
-
-    /* Copy the object's pixel data. */
-    for (; SCROLL_X_DIM > idx && img->hdr.width > imgx; idx++, imgx++) {
-        pixel = img->img[yoff + imgx];
-
-        /* Don't copy transparent pixels. */
-        if (OBJ_CLR_TRANSP != pixel) {
-        buf[idx] = pixel;
-        }
-    }
+    /* Copy the object's opaque pixels(transparent ones are skipped). */
+    draw_image_row (img, y - obj_y, obj_x - x, buf, SCROLL_X_DIM);
     }
 }
 
@@ -210,31 +313,31 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 void
 fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
 {
-    int            idx;   /* loop index over pixels in the line          */ 
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgy;  /* loop index over pixels in object image      */ 
-    int            xoff;  /* x offset into object image                  */ 
-    uint8_t        pixel; /* pixel from object image                     */
-    const photo_t* view;  /* room photo                                  */
+    const obj_span_t* spans; /* objects in the current room              */
+    int32_t        n_objs; /* number of objects in the current room      */
+    int32_t        i;     /* loop index over objects in the current room */
+    photo_t*       view;  /* room photo                                  */
     int32_t        obj_x; /* object x position                           */
     int32_t        obj_y; /* object y position                           */
     const image_t* img;   /* object image                                */
 
-    /* Get pointer to current photo of current room. */
+    /* 
+     * Read the line from the current photo of the current room.  Unless
+     * the photo is tiled, make the column copy of the photo first if
+     * there is none yet.
+     */
     view = room_photo (cur_room);
-
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
-        buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
-            view->img[view->hdr.width * (y + idx) + x] : 0);
+    if (NULL == view->tiles) {
+        (void)transpose_photo (view);
     }
+    read_photo_col (view, x, y, buf, SCROLL_Y_DIM);
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-         obj = obj_next (obj)) {
-    obj_x = obj_get_x (obj);
-    obj_y = obj_get_y (obj);
-    img = obj_image (obj);
+    /* Loop over objects in the current room(cached spans). */
+    n_objs = room_object_spans (cur_room, &spans);
+    for (i = 0; n_objs > i; i++) {
+    obj_x = spans[i].x;
+    obj_y = spans[i].y;
+    img = spans[i].img;
 
         /* Is object outside of the line we're drawing? */
     if (x < obj_x || x >= obj_x + img->hdr.width ||
@@ -242,30 +345,75 @@ fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
         continue;
     }
 
-    /* The x offset of drawing is fixed. */
-    xoff = x - obj_x;
+    /* Copy the object's opaque pixels(transparent ones are skipped). */
+    draw_image_col (img, x - obj_x, obj_y - y, buf, SCROLL_Y_DIM);
+    }
+}
 
-    /* 
-     * The y offsets depend on whether the object starts below or 
-     * above the starting point for the line being drawn.
-     */
-    if (y <= obj_y) {
-        idx = obj_y - y;
-        imgy = 0;
-    } else {
-        idx = 0;
-        imgy = y - obj_y;
+
+/* 
+ * fill_rect_buffer
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the upper left
+ *                pixel of a rectangle to be drawn on the screen, this
+ *                routine produces an image of the rectangle, one row of
+ *                w pixels after another.  The photo is looked up once
+ *                and each object is clipped to the rectangle only once.
+ *
+ *                Note that this routine draws both the room photo and
+ *                the objects in the room.
+ *
+ *   INPUTS: (x,y) -- upper left pixel of rectangle to be drawn
+ *           w, h -- width and height of the rectangle
+ *           stride -- distance in buf from one row to the next
+ *   OUTPUTS: buf -- buffer holding image data for the rectangle
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_rect_buffer (int x, int y, int w, int h, unsigned char* buf, int stride)
+{
+    const obj_span_t* spans; /* objects in the current room              */
+    int32_t        n_objs; /* number of objects in the current room      */
+    int32_t        i;     /* loop index over objects in the current room */
+    int32_t        j;     /* loop index over rows/columns                */
+    const photo_t* view;  /* room photo                                  */
+    int32_t        top;   /* first row of object in rectangle            */
+    int32_t        bottom; /* one past last row of object in rectangle   */
+    int32_t        left;  /* first column of object in rectangle         */
+    int32_t        right; /* one past last column of object in rectangle */
+    const image_t* img;   /* object image                                */
+
+    /* Read the rectangle from the current photo of the current room. */
+    view = room_photo (cur_room);
+    for (j = 0; h > j; j++) {
+        read_photo_row (view, x, y + j, buf + stride * j, w);
     }
 
-    /* Copy the object's pixel data. */
-    for (; SCROLL_Y_DIM > idx && img->hdr.height > imgy; idx++, imgy++) {
-        pixel = img->img[xoff + img->hdr.width * imgy];
+    /* Loop over objects in the current room(cached spans). */
+    n_objs = room_object_spans (cur_room, &spans);
+    for (i = 0; n_objs > i; i++) {
+        img = spans[i].img;
 
-        /* Don't copy transparent pixels. */
-        if (OBJ_CLR_TRANSP != pixel) {
-        buf[idx] = pixel;
+        /* Clip the object to the rectangle. */
+        left = (spans[i].x > x ? spans[i].x : x);
+        right = spans[i].x + img->hdr.width;
+        if (right > x + w) {
+            right = x + w;
+        }
+        top = (spans[i].y > y ? spans[i].y : y);
+        bottom = spans[i].y + img->hdr.height;
+        if (bottom > y + h) {
+            bottom = y + h;
+        }
+        if (left >= right || top >= bottom) {
+            continue;
+        }
+
+        /* Copy the object's opaque pixels(transparent ones are skipped). */
+        for (j = top; bottom > j; j++) {
+            draw_image_row (img, j - spans[i].y, spans[i].x - x, 
+                            buf + stride * (j - y), w);
         }
-    }
     }
 }
 
@@ -344,314 +492,1612 @@ prep_room (const room_t* r)
 {
     /* Record the current room. */
     photo_t *p = room_photo(r);
+
+    /* Make sure that the photo has been loaded(waits if in progress). */
+    if (0 != load_photo (p, NULL)) {
+        PANIC ("can't load room photo");
+    }
     cur_room = r;
     fill_palette(p->palette);
 }
 
 
 /* 
- * read_obj_image
- *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
- *                photo file and create an image structure from it.
- *   INPUTS: fname -- file name for input
+ * transpose_photo
+ *   DESCRIPTION: Get the copy of a room photo's pixels stored column by
+ *                column(column x starts at x times the photo height),
+ *                making it if necessary.  Copies of other photos are
+ *                freed, oldest first, to keep the memory used within
+ *                PHOTO_TRANSPOSE_BUDGET.  The copy is made in 16x16
+ *                blocks so that both the rows read and the columns
+ *                written stay in the cache.
+ *   INPUTS: p -- the photo(loaded)
  *   OUTPUTS: none
- *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
- *                 on failure
- *   SIDE EFFECTS: dynamically allocates memory for the image
+ *   RETURN VALUE: the column copy, or NULL if the photo does not fit in
+ *                 the budget or memory allocation fails
+ *   SIDE EFFECTS: may allocate memory for the copy and free copies of
+ *                 other photos
  */
-image_t*
-read_obj_image (const char* fname)
+static const uint8_t*
+transpose_photo (photo_t* p)
 {
-    FILE*    in;        /* input file               */
-    image_t* img = NULL;    /* image structure          */
-    uint16_t x;         /* index over image columns */
-    uint16_t y;         /* index over image rows    */
-    uint8_t  pixel;     /* one pixel from the file  */
+    size_t    size = (size_t)p->hdr.width * p->hdr.height; /* copy size */
+    photo_t** find;     /* link to oldest photo with a copy    */
+    photo_t*  old;      /* photo whose copy is freed           */
+    uint32_t  bx;       /* left column of block                */
+    uint32_t  by;       /* top row of block                    */
+    uint32_t  x;        /* index over columns                  */
+    uint32_t  y;        /* index over rows                     */
 
-    /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the image pixels.
-     * If anything fails, clean up as necessary and return NULL.
-     */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-    NULL == (img = malloc (sizeof (*img))) ||
-    NULL != (img->img = NULL) || /* false clause for initialization */
-    1 != fread (&img->hdr, sizeof (img->hdr), 1, in) ||
-    MAX_OBJECT_WIDTH < img->hdr.width ||
-    MAX_OBJECT_HEIGHT < img->hdr.height ||
-    NULL == (img->img = malloc 
-         (img->hdr.width * img->hdr.height * sizeof (img->img[0])))) {
-    if (NULL != img) {
-        if (NULL != img->img) {
-            free (img->img);
-        }
-        free (img);
-    }
-    if (NULL != in) {
-        (void)fclose (in);
+    if (NULL != p->col_img) {
+        return p->col_img;
     }
-    return NULL;
+    if (PHOTO_TRANSPOSE_BUDGET < size) {
+        return NULL;
     }
 
-    /* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
-     */
-    for (y = img->hdr.height; y-- > 0; ) {
-
-    /* Loop over columns from left to right. */
-    for (x = 0; img->hdr.width > x; x++) {
+    /* Free the oldest copies until this one fits. */
+    while (PHOTO_TRANSPOSE_BUDGET - transposed_bytes < size) {
+        for (find = &transposed; NULL != (*find)->next_transposed; 
+             find = &(*find)->next_transposed) {
+        }
+        old = *find;
+        *find = NULL;
+        free (old->col_img);
+        old->col_img = NULL;
+        transposed_bytes -= (size_t)old->hdr.width * old->hdr.height;
+        transposed_evicted++;
+    }
 
-        /* 
-         * Try to read one 8-bit pixel.  On failure, clean up and 
-         * return NULL.
-         */
-        if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-        free (img->img);
-        free (img);
-            (void)fclose (in);
+    if (NULL == (p->col_img = malloc (size))) {
         return NULL;
+    }
+    for (by = 0; p->hdr.height > by; by += 16) {
+        for (bx = 0; p->hdr.width > bx; bx += 16) {
+            for (x = bx; p->hdr.width > x && bx + 16 > x; x++) {
+                for (y = by; p->hdr.height > y && by + 16 > y; y++) {
+                    p->col_img[p->hdr.height * x + y] = 
+                            p->img[p->hdr.width * y + x];
+                }
+            }
         }
-
-        /* Store the pixel in the image data. */
-        img->img[img->hdr.width * y + x] = pixel;
     }
+
+    p->next_transposed = transposed;
+    transposed = p;
+    transposed_bytes += size;
+    if (transposed_peak < transposed_bytes) {
+        transposed_peak = transposed_bytes;
     }
+    transposed_built++;
+    return p->col_img;
+}
 
-    /* All done.  Return success. */
-    (void)fclose (in);
-    return img;
+
+/* 
+ * photo_transpose_report
+ *   DESCRIPTION: Write the memory used by column copies of room photos
+ *                (see transpose_photo) to a file as one line of
+ *                key=value pairs: the bytes in use, the most ever in
+ *                use, the budget, and the numbers of copies made and
+ *                freed to make room.
+ *   INPUTS: f -- the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to the file
+ */
+void
+photo_transpose_report (FILE* f)
+{
+    fprintf (f, "transposed_bytes=%lu peak_bytes=%lu budget_bytes=%lu "
+             "built=%u evicted=%u\n", (unsigned long)transposed_bytes,
+             (unsigned long)transposed_peak,
+             (unsigned long)PHOTO_TRANSPOSE_BUDGET, transposed_built,
+             transposed_evicted);
 }
 
 
+#if defined(PHOTO_TILED_LAYOUT) || defined(PHOTO_BENCHMARK_PROGRAM)
 /* 
- * read_photo
- *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
- *                photo file and create a photo structure from it.
- *                Code provided simply maps to 2:2:2 RGB.  You must
- *                replace this code with palette color selection, and
- *                must map the image pixels into the palette colors that
- *                you have defined.
- *   INPUTS: fname -- file name for input
+ * tile_photo
+ *   DESCRIPTION: Make the copy of a room photo's pixels stored tile by
+ *                tile(see PHOTO_TILE_SHIFT), copying each tile row as
+ *                one block.
+ *   INPUTS: p -- the photo(pixels loaded into img)
  *   OUTPUTS: none
- *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
- *                 on failure
- *   SIDE EFFECTS: dynamically allocates memory for the photo
+ *   RETURN VALUE: 0 on success, or -1 if memory allocation fails
+ *   SIDE EFFECTS: dynamically allocates memory for the tiles
  */
-photo_t*
-read_photo (const char* fname)
+static int32_t
+tile_photo (photo_t* p)
 {
-    FILE*    in;    /* input file               */
-    photo_t* p = NULL;  /* photo structure          */
-    uint16_t x;     /* index over image columns */
-    uint16_t y;     /* index over image rows    */
-    uint16_t pixel; /* one pixel from the file  */
-     struct octree_node_level2 level_2[level_2_size];    //8^2 nodes
-    struct octree_node_level4 level_4[level_4_size];    //8^4 nodes
-    /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the photo pixels.
-     * If anything fails, clean up as necessary and return NULL.
-     */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-    NULL == (p = malloc (sizeof (*p))) ||
-    NULL != (p->img = NULL) || /* false clause for initialization */
-    1 != fread (&p->hdr, sizeof (p->hdr), 1, in) ||
-    MAX_PHOTO_WIDTH < p->hdr.width ||
-    MAX_PHOTO_HEIGHT < p->hdr.height ||
-    NULL == (p->img = malloc 
-         (p->hdr.width * p->hdr.height * sizeof (p->img[0])))) {
-    if (NULL != p) {
-        if (NULL != p->img) {
-            free (p->img);
-        }
-        free (p);
-    }
-    if (NULL != in) {
-        (void)fclose (in);
+    uint32_t tiles_x;   /* tiles per row of tiles              */
+    uint32_t tiles_y;   /* rows of tiles                       */
+    uint32_t x;         /* left column of tile row             */
+    uint32_t y;         /* index over rows                     */
+    uint32_t n;         /* pixels in tile row                  */
+    uint8_t* row;       /* first tile of the row of tiles      */
+
+    tiles_x = (p->hdr.width + PHOTO_TILE_MASK) >> PHOTO_TILE_SHIFT;
+    tiles_y = (p->hdr.height + PHOTO_TILE_MASK) >> PHOTO_TILE_SHIFT;
+    if (NULL == (p->tiles = calloc ((size_t)tiles_x * tiles_y, 
+                                    PHOTO_TILE_SIZE))) {
+        return -1;
     }
-    return NULL;
+    for (y = 0; p->hdr.height > y; y++) {
+        row = p->tiles + 
+              (((size_t)(y >> PHOTO_TILE_SHIFT) * tiles_x) << 
+               (2 * PHOTO_TILE_SHIFT)) +
+              ((y & PHOTO_TILE_MASK) << PHOTO_TILE_SHIFT);
+        for (x = 0; p->hdr.width > x; x += PHOTO_TILE_DIM) {
+            n = (p->hdr.width - x < PHOTO_TILE_DIM ? 
+                 p->hdr.width - x : PHOTO_TILE_DIM);
+            memcpy (row + (x << PHOTO_TILE_SHIFT), 
+                    p->img + p->hdr.width * y + x, n);
+        }
     }
-    int position[level_4_size];
-    uint32_t    i; 
-    uint16_t    pixels_array[p->hdr.width * p->hdr.height]; //store all pixels
-    uint32_t temp;
-    
-    //intialize level_4 and the array stores the index before the sort
-    for(i = 0; i < level_4_size; ++i)
-    {
-        level_4[i].idx_original = i;
-        level_4[i].idx_level_2 = init_100;
-        level_4[i].red_sum = 0;
-        level_4[i].green_sum = 0;
-        level_4[i].blue_sum = 0;
-        level_4[i].pixel_number = 0;
-        level_4[i].palette_idx = init_neg1;
-        position[i] = init_neg1;
+    return 0;
+}
+#endif
+
+
+/* 
+ * read_photo_row
+ *   DESCRIPTION: Read part of a row of a room photo, from its tiles if
+ *                it has been tiled or else from its rows.  Pixels
+ *                outside of the photo read as 0.
+ *   INPUTS: p -- the photo(loaded)
+ *           (x,y) -- photo coordinates of the first pixel
+ *           len -- number of pixels to read
+ *   OUTPUTS: buf -- the pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+read_photo_row (const photo_t* p, int32_t x, int32_t y, uint8_t* buf, 
+                int32_t len)
+{
+    int32_t        start; /* first pixel of buf inside the photo       */
+    int32_t        end;   /* one past last pixel of buf inside photo   */
+    int32_t        i;     /* index over pixels in buf                  */
+    int32_t        n;     /* pixels read from one tile                 */
+    const uint8_t* row;   /* start of row y in the first tile          */
+
+    start = (0 > x ? -x : 0);
+    end = (p->hdr.width - x < len ? p->hdr.width - x : len);
+    if (0 > y || p->hdr.height <= y || start >= end) {
+        memset (buf, 0, len);
+        return;
     }
-    
-    //intialize level_2
-    for(i = 0; i < level_2_size; ++i)
-    {
-        level_2[i].red_sum = 0;
-        level_2[i].green_sum = 0;
-        level_2[i].blue_sum = 0;
-        level_2[i].pixel_number = 0;
-        level_2[i].palette_idx = init_neg1;
-        
+    memset (buf, 0, start);
+    memset (buf + end, 0, len - end);
+
+    if (NULL == p->tiles) {
+        memcpy (buf + start, p->img + p->hdr.width * y + x + start, 
+                end - start);
+        return;
     }
-    
-    /*first loop over file: map all the pixels into leverl4 array 
-     *and record the number of pixels in each node, also records their sum of RGB
-     *this loop also put the file into the pixels array*/
-    
-    /* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
-     */
-    for (y = p->hdr.height; y-- > 0; ) 
-    {
-        /* Loop over columns from left to right. */
-        for (x = 0; p->hdr.width > x; x++) 
-        {
-        /* 
-         * Try to read one 16-bit pixel.  On failure, clean up and 
-         * return NULL.
-         */
-            if (1 != fread (&pixel, sizeof (pixel), 1, in)) 
-            {
-                free (p->img);
-                free (p);
-                (void)fclose (in);
-                return NULL;
-            }
-        
-        i = map_to_octree (pixel, rep_level_4); //find the index in level 4
-        level_4[i].idx_level_2 = map_to_octree(pixel, rep_level_2); //find the index in level 2
-        pixels_array[p->hdr.width * y + x] = pixel; //stores every pixel
-        temp = pixel >> shift_11;//for calculating the sum of red
-        level_4[i].red_sum += temp & mask_1f;
-        temp=pixel >> shift_5; //for calculating the sum of green
-        level_4[i].green_sum += temp& mask_3f;
-        level_4[i].blue_sum += pixel & mask_1f; //calculate the sum of blue
-        level_4[i].idx_original = i; //the current index in level 4
-        level_4[i].pixel_number++; //count the # of pixels for current node
+    row = p->tiles + 
+          (((size_t)(y >> PHOTO_TILE_SHIFT) * 
+            ((p->hdr.width + PHOTO_TILE_MASK) >> PHOTO_TILE_SHIFT)) << 
+           (2 * PHOTO_TILE_SHIFT)) +
+          ((y & PHOTO_TILE_MASK) << PHOTO_TILE_SHIFT);
+    for (i = start; end > i; i += n) {
+        n = PHOTO_TILE_DIM - ((x + i) & PHOTO_TILE_MASK);
+        if (end - i < n) {
+            n = end - i;
         }
+        memcpy (buf + i, row + (((x + i) >> PHOTO_TILE_SHIFT) << 
+                                (2 * PHOTO_TILE_SHIFT)) + 
+                         ((x + i) & PHOTO_TILE_MASK), n);
     }
-    
-    /* no need for the file anymore */
-    (void)fclose (in);
-        qsort(level_4, level_4_size, sizeof(struct octree_node_level4), qsort_helper); //sort level 4 to get the first 128 colors
-    
-    
-    
-    for(i = 0; i < first_128; i++)//calculate the average rgb 
-    {
-        //if there is no pixel, draw black; otherwise, draw average rgb
-        level_4[i].red_average = (level_4[i].pixel_number==0)?0:level_4[i].red_sum / level_4[i].pixel_number;
-        level_4[i].green_average = (level_4[i].pixel_number==0)?0:level_4[i].green_sum / level_4[i].pixel_number;
-        level_4[i].blue_average =  (level_4[i].pixel_number==0)?0:level_4[i].blue_sum / level_4[i].pixel_number;
-        level_4[i].palette_idx = old_64 + i;
-        position[level_4[i].idx_original] = i;
-    }
-    
-    //calculate the sum of rgb for each node after the first 128 in level 4
-    for(i = first_128; i < level_4_size; i++)
-    {
-        if(level_4[i].idx_level_2 < level_2_size) //find the rgb of the next 64 colors
-        {
-            level_2[level_4[i].idx_level_2].red_sum += level_4[i].red_sum;
-            level_2[level_4[i].idx_level_2].green_sum += level_4[i].green_sum;
-            level_2[level_4[i].idx_level_2].blue_sum += level_4[i].blue_sum;
-            level_2[level_4[i].idx_level_2].pixel_number += level_4[i].pixel_number;
+}
+
+
+/* 
+ * read_photo_col
+ *   DESCRIPTION: Read part of a column of a room photo, from its tiles
+ *                if it has been tiled, from its column copy(see
+ *                transpose_photo) if it has one, or else from its rows.
+ *                Pixels above or below the photo read as 0, as do
+ *                columns left or right of a tiled photo.
+ *   INPUTS: p -- the photo(loaded)
+ *           (x,y) -- photo coordinates of the first pixel
+ *           len -- number of pixels to read
+ *   OUTPUTS: buf -- the pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+read_photo_col (const photo_t* p, int32_t x, int32_t y, uint8_t* buf, 
+                int32_t len)
+{
+    int32_t        idx;   /* index over pixels in buf                  */
+    int32_t        start; /* first pixel of buf inside the photo       */
+    int32_t        end;   /* one past last pixel of buf inside photo   */
+    int32_t        n;     /* pixels read from one tile                 */
+    const uint8_t* src;   /* next pixel read                           */
+    size_t         down;  /* distance from a tile to the one below     */
+
+    if (NULL == p->tiles && (0 > x || p->hdr.width <= x || 
+                             NULL == p->col_img)) {
+        for (idx = 0; idx < len; idx++) {
+            buf[idx] = (0 <= y + idx && p->hdr.height > y + idx ?
+                p->img[p->hdr.width * (y + idx) + x] : 0);
         }
-        position[level_4[i].idx_original] = i; //otherwise, update the position
-    }
-        
-     for(i = 0; i < level_2_size; i++) //calculate the avg rgb for the next 64 colors
-    {
-        //if there is no pixel, draw black; otherwise, draw average rgb
-        level_2[i].red_average = (level_2[i].pixel_number==0)?0:level_2[i].red_sum / level_2[i].pixel_number;
-        level_2[i].green_average = (level_2[i].pixel_number==0)?0:level_2[i].green_sum / level_2[i].pixel_number;
-        level_2[i].blue_average =  (level_2[i].pixel_number==0)?0:level_2[i].blue_sum / level_2[i].pixel_number;
-        level_2[i].palette_idx = old_64 + first_128 + i; 
+        return;
     }
 
-    for(i = 0; i < level_2_size; i++){ //fill the palette for the second 64 color
-        p->palette[i+first_128][0] = (level_2[i].red_average & 0x1F) << 1;
-        p->palette[i+first_128][1] = level_2[i].green_average & 0x3F;
-        p->palette[i+first_128][2] = (level_2[i].blue_average & 0x1F) << 1;
+    start = (0 > y ? -y : 0);
+    end = (p->hdr.height - y < len ? p->hdr.height - y : len);
+    if (0 > x || p->hdr.width <= x || start >= end) {
+        memset (buf, 0, len);
+        return;
     }
+    memset (buf, 0, start);
+    memset (buf + end, 0, len - end);
 
-    for(i = 0; i < first_128; i++){ //fill the pelette for the 128 colors
-        p->palette[i][0] = (level_4[i].red_average & 0x1F) << 1;
-        p->palette[i][1] = level_4[i].green_average & 0x3F;
-        p->palette[i][2] = (level_4[i].blue_average & 0x1F) << 1;
+    if (NULL == p->tiles) {
+        memcpy (buf + start, p->col_img + p->hdr.height * x + y + start, 
+                end - start);
+        return;
     }
-
-    //find the 128 colors' palette_idx in level 2
-    for(i = first_128; i < level_4_size; i++)
-    {
-        if(level_4[i].idx_level_2 < level_2_size)
-        {
-            level_4[i].palette_idx = level_2[level_4[i].idx_level_2].palette_idx; 
-        }       
+    down = ((size_t)((p->hdr.width + PHOTO_TILE_MASK) >> PHOTO_TILE_SHIFT)) <<
+           (2 * PHOTO_TILE_SHIFT);
+    for (idx = start; end > idx; ) {
+        src = p->tiles + ((y + idx) >> PHOTO_TILE_SHIFT) * down + 
+              ((x >> PHOTO_TILE_SHIFT) << (2 * PHOTO_TILE_SHIFT)) +
+              (((y + idx) & PHOTO_TILE_MASK) << PHOTO_TILE_SHIFT) + 
+              (x & PHOTO_TILE_MASK);
+        n = PHOTO_TILE_DIM - ((y + idx) & PHOTO_TILE_MASK);
+        if (end - idx < n) {
+            n = end - idx;
+        }
+        for (; 0 < n; n--, idx++, src += PHOTO_TILE_DIM) {
+            buf[idx] = *src;
+        }
     }
-    
-    //fill palette for the image
-    for(i = 0; i < p->hdr.width * p->hdr.height; i++)
-     {
-            p->img[i] = level_4[position[map_to_octree(pixels_array[i], rep_level_4)]].palette_idx;
-     }
-    
-    return p;
 }
 
 
-/*
- *map_to_octree
- *Description: helper function that convert the 16 bit RGB value to map to level 2 or level 4 nodes
- *              only takes the first x bits from each R,G,B and get them togeter
- *Input: pixel: the 16 bit pixel (5:6:5)  of RGB
- *       level_number: 2 or 4, indicate which level of octree does the pixel map to
- *Output: None
- *Return Value: the position in array_2 or array_4, for array_2, it only occupies the last 6 bits
-          for array_4, it occupies the last 12 bits
- *Side Effects: None
+/* 
+ * read_obj_image
+ *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
+ *                photo file and create an image structure from it.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the image(the pixels
+ *                 of a top-down image in the asset pack are not copied)
  */
-uint16_t map_to_octree (const uint16_t pixel, const uint8_t level_number)
+image_t*
+read_obj_image (const char* fname)
 {
-    if(level_number != rep_level_2 && level_number != rep_level_4)
-        return -1;
-    uint16_t pixel_copy = pixel;
-    if(level_number == rep_level_2)
-    {
-        return (((pixel_copy >> shift_14) << shift_4) | (((pixel_copy >> shift_9) & mask_3) << shift_2) | ((pixel_copy >> shift_3) & mask_3));
+    image_t* img;       /* image structure          */
+
+    /* 
+     * Allocate the structure, then read the header and the pixels.  If
+     * anything fails, clean up as necessary and return NULL.
+     */
+    if (NULL == (img = malloc (sizeof (*img)))) {
+        return NULL;
     }
-    else
-    {
-        return (((pixel_copy >> shift_12) << shift_8) | (((pixel_copy >> shift_7) & mask_000f) << shift_4) | ((pixel_copy >> 1) & mask_000f));
-    }   
+    if (NULL == (img->img = read_image_file (fname, &img->hdr, 
+                    sizeof (img->img[0]), MAX_OBJECT_WIDTH, MAX_OBJECT_HEIGHT,
+                    NULL))) {
+        free (img);
+        return NULL;
+    }
+    if (0 != build_image_runs (img)) {
+        /* Pixels in the asset pack were not allocated. */
+        if (!in_asset_pack (img->img)) {
+            free (img->img);
+        }
+        free (img);
+        return NULL;
+    }
+
+    /* All done.  Return success. */
+    return img;
 }
 
 
-/*
- *qsort_helper
- *Description: helper function that compare the number of pixels in two octree nodes
- *Input: general pointer a and b
- *Output: None
- *Return Value: > 0 if the element pointed by a goes after the element pointed by b
- *Side Effects: None
+/* 
+ * build_image_runs
+ *   DESCRIPTION: List the runs of opaque pixels in each row and each
+ *                column of an object image, and make the copy of the
+ *                pixels stored column by column(see image_t).
+ *   INPUTS: im -- the image(header and pixels already read)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: dynamically allocates one block of memory for the run
+ *                 tables and the column copy
  */
-int qsort_helper(const void *a, const void *b)
+static int32_t
+build_image_runs (image_t* im)
 {
-    const struct octree_node_level4* octree_node_a = a;
-    const struct octree_node_level4* octree_node_b = b;
-    return (octree_node_b->pixel_number - octree_node_a->pixel_number);
-    
-}
+    uint32_t       w = im->hdr.width;   /* image width              */
+    uint32_t       h = im->hdr.height;  /* image height             */
+    const uint8_t* px = im->img;        /* pixel data               */
+    uint32_t       n_runs;              /* runs in rows and columns */
+    uint32_t       n;                   /* runs found so far        */
+    uint32_t       x;                   /* index over columns       */
+    uint32_t       y;                   /* index over rows          */
+    uint32_t       start;               /* start of a run           */
+    uint8_t*       block;               /* memory for the tables    */
+
+    /* Count the runs: each starts at an opaque pixel after a transparent one. */
+    n_runs = 0;
+    for (y = 0; h > y; y++) {
+        for (x = 0; w > x; x++) {
+            if (OBJ_CLR_TRANSP != px[y * w + x]) {
+                n_runs += (0 == x || OBJ_CLR_TRANSP == px[y * w + x - 1]);
+                n_runs += (0 == y || OBJ_CLR_TRANSP == px[(y - 1) * w + x]);
+            }
+        }
+    }
 
+    /* Allocate the run tables and the column copy as one block. */
+    if (NULL == (block = malloc ((h + 1 + w + 1) * sizeof (im->row_first[0]) +
+                                 n_runs * sizeof (im->runs[0]) + w * h))) {
+        return -1;
+    }
+    im->row_first = (uint16_t*)block;
+    im->col_first = im->row_first + h + 1;
+    im->runs = (image_run_t*)(im->col_first + w + 1);
+    im->col_img = (uint8_t*)(im->runs + n_runs);
 
+    /* Find the runs of each row, then of each column. */
+    for (y = 0, n = 0; h > y; y++) {
+        im->row_first[y] = n;
+        for (x = 0; w > x; ) {
+            for (; w > x && OBJ_CLR_TRANSP == px[y * w + x]; x++) {
+            }
+            for (start = x; w > x && OBJ_CLR_TRANSP != px[y * w + x]; x++) {
+            }
+            if (start < x) {
+                im->runs[n].start = start;
+                im->runs[n++].len = x - start;
+            }
+        }
+    }
+    im->row_first[h] = n;
+    for (x = 0; w > x; x++) {
+        im->col_first[x] = n;
+        for (y = 0; h > y; y++) {
+            im->col_img[x * h + y] = px[y * w + x];
+        }
+        for (y = 0; h > y; ) {
+            for (; h > y && OBJ_CLR_TRANSP == px[y * w + x]; y++) {
+            }
+            for (start = y; h > y && OBJ_CLR_TRANSP != px[y * w + x]; y++) {
+            }
+            if (start < y) {
+                im->runs[n].start = start;
+                im->runs[n++].len = y - start;
+            }
+        }
+    }
+    im->col_first[w] = n;
+
+    return 0;
+}
+
+
+/* 
+ * draw_image_row
+ *   DESCRIPTION: Copy the opaque pixels of one row of an object image
+ *                into a line buffer, one run at a time.
+ *   INPUTS: im -- the image
+ *           imgy -- the image row
+ *           dx -- position in the buffer of the image's left column(may
+ *                 be negative or beyond the buffer)
+ *           buf -- the buffer
+ *           len -- length of the buffer
+ *   OUTPUTS: buf -- opaque pixels overwritten
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+draw_image_row (const image_t* im, int32_t imgy, int32_t dx, uint8_t* buf, 
+                int32_t len)
+{
+    const image_run_t* r = im->runs + im->row_first[imgy];   /* a run  */
+    const image_run_t* end = im->runs + im->row_first[imgy + 1];
+    const uint8_t*     src = im->img + imgy * im->hdr.width; /* row    */
+    int32_t            lo;  /* first buffer pixel of run */
+    int32_t            hi;  /* buffer pixel after run    */
+
+    for (; end > r; r++) {
+        lo = dx + r->start;
+        hi = lo + r->len;
+        lo = (0 > lo ? 0 : lo);
+        hi = (len < hi ? len : hi);
+        if (lo < hi) {
+            memcpy (buf + lo, src + lo - dx, hi - lo);
+        }
+    }
+}
+
+
+/* 
+ * draw_image_col
+ *   DESCRIPTION: Copy the opaque pixels of one column of an object image
+ *                into a line buffer, one run at a time.
+ *   INPUTS: im -- the image
+ *           imgx -- the image column
+ *           dy -- position in the buffer of the image's top row(may be
+ *                 negative or beyond the buffer)
+ *           buf -- the buffer
+ *           len -- length of the buffer
+ *   OUTPUTS: buf -- opaque pixels overwritten
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+draw_image_col (const image_t* im, int32_t imgx, int32_t dy, uint8_t* buf, 
+                int32_t len)
+{
+    const image_run_t* r = im->runs + im->col_first[imgx];      /* a run */
+    const image_run_t* end = im->runs + im->col_first[imgx + 1];
+    const uint8_t*     src = im->col_img + imgx * im->hdr.height; /* col */
+    int32_t            lo;  /* first buffer pixel of run */
+    int32_t            hi;  /* buffer pixel after run    */
+
+    for (; end > r; r++) {
+        lo = dy + r->start;
+        hi = lo + r->len;
+        lo = (0 > lo ? 0 : lo);
+        hi = (len < hi ? len : hi);
+        if (lo < hi) {
+            memcpy (buf + lo, src + lo - dy, hi - lo);
+        }
+    }
+}
+
+
+/* 
+ * read_image_file
+ *   DESCRIPTION: Read the header and pixel data of a room photo or object
+ *                image file, from the asset pack if it holds the file.
+ *                The file is mapped into memory rather than read pixel by
+ *                pixel, and its rows are copied whole into a new buffer.
+ *                Rows are stored in the file from bottom to top, whereas
+ *                in memory we store them in the reverse order(top to
+ *                bottom); files in the pack may already be top down.
+ *   INPUTS: fname -- file name for input
+ *           pixel_size -- bytes per pixel in the file(and the buffer)
+ *           max_width -- largest acceptable width in pixels
+ *           max_height -- largest acceptable height in pixels
+ *           buf -- buffer for the pixels, large enough for an image of
+ *                  the maximum size, or NULL to allocate a new buffer
+ *   OUTPUTS: hdr -- the header read from the file
+ *   RETURN VALUE: pointer to pixel data(top row first) on success, or
+ *                 NULL on failure(including files too short to hold all
+ *                 of the pixels)
+ *   SIDE EFFECTS: dynamically allocates memory for the pixels if buf
+ *                 is NULL, unless the pixels are top down in the asset
+ *                 pack, in which case a pointer into the pack(read-only;
+ *                 never to be freed) is returned
+ */
+static void*
+read_image_file (const char* fname, photo_header_t* hdr, uint32_t pixel_size,
+                 uint32_t max_width, uint32_t max_height, void* buf)
+{
+    asset_t        a;           /* file contents                */
+    const uint8_t* src;         /* first pixel in the file      */
+    uint8_t*       pixels;      /* pixel data in memory         */
+    size_t         row_len;     /* bytes per row                */
+    uint32_t       y;           /* index over image rows        */
+
+    /* 
+     * Find the file, then do some sanity checks on the header and the
+     * file size.  If anything fails, clean up as necessary and return
+     * NULL.
+     */
+    if (0 != get_asset (fname, &a)) {
+        return NULL;
+    }
+    if (sizeof (*hdr) > a.len) {
+        put_asset (&a);
+        return NULL;
+    }
+    memcpy (hdr, a.data, sizeof (*hdr));
+    row_len = (size_t)hdr->width * pixel_size;
+    if (max_width < hdr->width || max_height < hdr->height ||
+        sizeof (*hdr) + row_len * hdr->height > a.len) {
+        put_asset (&a);
+        return NULL;
+    }
+    src = a.data + sizeof (*hdr);
+
+    /* Top-down pixels in the pack can be used where they are. */
+    if (NULL == buf && a.in_pack && 0 != (a.flags & ASSET_TOP_DOWN)) {
+        return (void*)src;
+    }
+
+    if (NULL == (pixels = (NULL != buf ? buf : 
+                           malloc (row_len * hdr->height)))) {
+        put_asset (&a);
+        return NULL;
+    }
+    if (0 != (a.flags & ASSET_TOP_DOWN)) {
+        memcpy (pixels, src, row_len * hdr->height);
+    } else {
+        /* Copy rows, flipping the image vertically. */
+        for (y = hdr->height; y-- > 0; src += row_len) {
+            memcpy (pixels + row_len * y, src, row_len);
+        }
+    }
+
+    put_asset (&a);
+    return pixels;
+}
+
+
+/* 
+ * map_file
+ *   DESCRIPTION: Map a whole file into memory for reading.
+ *   INPUTS: fname -- file name
+ *   OUTPUTS: len -- length of the file in bytes
+ *   RETURN VALUE: pointer to the file contents(release with munmap), or
+ *                 NULL on failure(including empty files)
+ *   SIDE EFFECTS: maps memory
+ */
+static const uint8_t*
+map_file (const char* fname, size_t* len)
+{
+    int         fd;     /* input file descriptor    */
+    struct stat st;     /* input file status(size)  */
+    void*       map;    /* file contents mapped     */
+
+    if (-1 == (fd = open (fname, O_RDONLY))) {
+        return NULL;
+    }
+    if (0 != fstat (fd, &st) || 0 == st.st_size ||
+        MAP_FAILED == (map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, 
+                                   fd, 0))) {
+        (void)close (fd);
+        return NULL;
+    }
+    (void)close (fd);
+    *len = st.st_size;
+    return map;
+}
+
+
+/* 
+ * open_asset_pack
+ *   DESCRIPTION: Map an asset pack(see photo_headers.h) so that room
+ *                photos and object images found in it are read from the
+ *                pack rather than from files of their own.  Call before
+ *                opening any photos or images.  The pack is mapped once
+ *                and stays mapped.
+ *   INPUTS: fname -- file name of the pack
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if the pack cannot be read or is
+ *                 not valid(in which case only individual files are used)
+ *   SIDE EFFECTS: maps the pack into memory
+ */
+int32_t
+open_asset_pack (const char* fname)
+{
+    const uint8_t*            map;  /* pack contents mapped     */
+    size_t                    len;  /* pack length in bytes     */
+    asset_pack_header_t       hdr;  /* pack header              */
+    const asset_pack_entry_t* toc;  /* table of contents        */
+    uint32_t                  i;    /* index over entries       */
+
+    if (NULL == (map = map_file (fname, &len))) {
+        return -1;
+    }
+    if (sizeof (hdr) > len) {
+        (void)munmap ((void*)map, len);
+        return -1;
+    }
+    memcpy (&hdr, map, sizeof (hdr));
+    toc = (const asset_pack_entry_t*)(map + sizeof (hdr));
+    if (0 != memcmp (hdr.magic, ASSET_PACK_MAGIC, sizeof (hdr.magic)) ||
+        (len - sizeof (hdr)) / sizeof (toc[0]) < hdr.n_entries) {
+        (void)munmap ((void*)map, len);
+        return -1;
+    }
+
+    /* 
+     * Check that each entry lies within the file and has a terminated
+     * name, and that the names are in order(for bsearch).
+     */
+    for (i = 0; hdr.n_entries > i; i++) {
+        if (toc[i].offset > len || toc[i].length > len - toc[i].offset ||
+            NULL == memchr (toc[i].name, '\0', ASSET_NAME_LEN) ||
+            (0 < i && 0 <= strcmp (toc[i - 1].name, toc[i].name))) {
+            (void)munmap ((void*)map, len);
+            return -1;
+        }
+    }
+
+    pack_map = map;
+    pack_len = len;
+    pack_toc = toc;
+    pack_n_entries = hdr.n_entries;
+    return 0;
+}
+
+
+/* 
+ * compare_asset_name
+ *   DESCRIPTION: Comparison function for finding an asset in the table
+ *                of contents of the asset pack with bsearch.
+ *   INPUTS: key -- the asset name
+ *           entry -- a table of contents entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as the name comes before,
+ *                 matches, or comes after the entry's name
+ *   SIDE EFFECTS: none
+ */
+static int
+compare_asset_name (const void* key, const void* entry)
+{
+    return strcmp (key, ((const asset_pack_entry_t*)entry)->name);
+}
+
+
+/* 
+ * in_asset_pack
+ *   DESCRIPTION: Check whether memory lies in the asset pack(and so must
+ *                not be written or freed).
+ *   INPUTS: ptr -- the memory
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if ptr points into the asset pack, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+in_asset_pack (const void* ptr)
+{
+    return (NULL != pack_map && (const uint8_t*)ptr >= pack_map && 
+            (const uint8_t*)ptr < pack_map + pack_len);
+}
+
+
+/* 
+ * get_asset
+ *   DESCRIPTION: Find the contents of an asset: in the asset pack if it
+ *                holds the asset, or else by mapping the asset's file.
+ *                Release the contents with put_asset.
+ *   INPUTS: fname -- file name of the asset
+ *   OUTPUTS: a -- the asset contents
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: may map memory
+ */
+static int32_t
+get_asset (const char* fname, asset_t* a)
+{
+    const asset_pack_entry_t* e = NULL; /* entry in the pack */
+
+    if (NULL != pack_toc) {
+        e = bsearch (fname, pack_toc, pack_n_entries, sizeof (*e), 
+                     compare_asset_name);
+    }
+    if (NULL != e) {
+        a->data = pack_map + e->offset;
+        a->len = e->length;
+        a->flags = e->flags;
+        a->in_pack = 1;
+        return 0;
+    }
+    if (NULL == (a->data = map_file (fname, &a->len))) {
+        return -1;
+    }
+    a->flags = 0;
+    a->in_pack = 0;
+    return 0;
+}
+
+
+/* 
+ * put_asset
+ *   DESCRIPTION: Release the contents of an asset found with get_asset.
+ *                Assets in the pack stay mapped.
+ *   INPUTS: a -- the asset contents
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may unmap memory
+ */
+static void
+put_asset (asset_t* a)
+{
+    if (!a->in_pack) {
+        (void)munmap ((void*)a->data, a->len);
+    }
+}
+
+
+/* 
+ * read_photo
+ *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
+ *                photo file and create a photo structure from it, 
+ *                selecting the optimized palette and mapping the pixels
+ *                into it before returning.  Precompiled photos(see
+ *                photo_headers.h) are also accepted, and their palette
+ *                and pixels are used as they are.
+ *   INPUTS: fname -- file name for input(not copied; must remain valid)
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo
+ */
+photo_t*
+read_photo (const char* fname)
+{
+    photo_t* p; /* photo structure */
+
+    if (NULL == (p = open_photo (fname))) {
+        return NULL;
+    }
+    if (0 != load_photo (p, NULL)) {
+        if (NULL == p->model) {
+            free (p->lut);
+        }
+        (void)pthread_cond_destroy (&p->loaded);
+        (void)pthread_mutex_destroy (&p->lock);
+        free (p);
+        return NULL;
+    }
+    return p;
+}
+
+
+/* 
+ * open_photo
+ *   DESCRIPTION: Read the size of a room photo from a photo file and
+ *                create a photo structure for it.  The palette and
+ *                pixel data are not available until load_photo has
+ *                been called, but the photo's width and height are.
+ *                Both 5:6:5 photos and precompiled photos(recognized
+ *                by their magic sequence) are accepted.
+ *   INPUTS: fname -- file name for input(not copied; must remain valid)
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo
+ */
+photo_t*
+open_photo (const char* fname)
+{
+    asset_t  a;     /* file contents            */
+    photo_t* p = NULL;  /* photo structure          */
+
+    /* 
+     * Find the file, allocate the structure, read the header, and do
+     * some sanity checks on it.  If anything fails, clean up as
+     * necessary and return NULL.
+     */
+    if (0 != get_asset (fname, &a)) {
+        return NULL;
+    }
+    if (sizeof (p->hdr) > a.len || NULL == (p = malloc (sizeof (*p)))) {
+        put_asset (&a);
+        return NULL;
+    }
+    memcpy (&p->hdr, a.data, sizeof (p->hdr));
+
+    /* 
+     * The header of a precompiled photo follows the magic sequence(which
+     * read as a header is too wide, so a truncated file is rejected).
+     */
+    p->precompiled = (0 == memcmp (a.data, PHOTO_PRECOMP_MAGIC, 
+                                   sizeof (p->hdr)));
+    if (p->precompiled && 2 * sizeof (p->hdr) <= a.len) {
+        memcpy (&p->hdr, a.data + sizeof (p->hdr), sizeof (p->hdr));
+    }
+    put_asset (&a);
+    if (MAX_PHOTO_WIDTH < p->hdr.width || MAX_PHOTO_HEIGHT < p->hdr.height) {
+        free (p);
+        return NULL;
+    }
+
+    p->img = NULL;
+    p->col_img = NULL;
+    p->next_transposed = NULL;
+    p->tiles = NULL;
+    p->lut = NULL;
+    p->model = NULL;
+    p->is_model = 0;
+    p->fname = fname;
+    p->state = PHOTO_PENDING;
+    (void)pthread_mutex_init (&p->lock, NULL);
+    (void)pthread_cond_init (&p->loaded, NULL);
+    return p;
+}
+
+
+/* 
+ * load_photo
+ *   DESCRIPTION: Make sure that the palette and pixel data of a photo
+ *                opened with open_photo have been loaded.  If no thread
+ *                has started to load the photo, the calling thread
+ *                loads it; if another thread is loading it, the calling
+ *                thread waits for that thread to finish.  Safe to call
+ *                from any number of threads.
+ *   INPUTS: p -- the photo
+ *           ctx -- decoding context for the calling thread, or NULL to
+ *                  use the shared default context
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the photo is loaded, or -1 if loading failed
+ *   SIDE EFFECTS: may block; dynamically allocates memory for the pixels
+ */
+int32_t
+load_photo (photo_t* p, photo_ctx_t* ctx)
+{
+    int32_t state; /* state of photo after loading */
+
+    (void)pthread_mutex_lock (&p->lock);
+    if (PHOTO_PENDING == p->state) {
+        p->state = PHOTO_LOADING;
+        (void)pthread_mutex_unlock (&p->lock);
+
+        /* 
+         * Decode and quantize without holding the lock.  Precompiled
+         * photos need no decoding context.
+         */
+        if (p->precompiled) {
+            state = (0 == read_precompiled_photo (p) ? PHOTO_READY : 
+                     PHOTO_FAILED);
+        } else if (NULL != ctx) {
+            state = (0 == quantize_photo (p, ctx) ? PHOTO_READY : PHOTO_FAILED);
+        } else {
+            (void)pthread_mutex_lock (&default_ctx_lock);
+            state = (0 == quantize_photo (p, &default_ctx) ? PHOTO_READY : 
+                     PHOTO_FAILED);
+            (void)pthread_mutex_unlock (&default_ctx_lock);
+        }
+#if defined(PHOTO_TILED_LAYOUT)
+        /* 
+         * Keep only the tiled copy of the pixels.  Pixels in the asset
+         * pack were not allocated.  If there is no memory for the tiles,
+         * the photo is simply drawn from its rows.
+         */
+        if (PHOTO_READY == state && 0 == tile_photo (p)) {
+            if (!in_asset_pack (p->img)) {
+                free (p->img);
+            }
+            p->img = NULL;
+        }
+#endif
+
+        (void)pthread_mutex_lock (&p->lock);
+        p->state = state;
+        (void)pthread_cond_broadcast (&p->loaded);
+    }
+    while (PHOTO_LOADING == p->state) {
+        (void)pthread_cond_wait (&p->loaded, &p->lock);
+    }
+    state = p->state;
+    (void)pthread_mutex_unlock (&p->lock);
+
+    return (PHOTO_READY == state ? 0 : -1);
+}
+
+
+/* 
+ * photo_share_palette
+ *   DESCRIPTION: Make a photo use the palette of another photo(for
+ *                example, the other photo of a room whose photo is
+ *                swapped).  When the photo is loaded, its pixels are
+ *                mapped through the other photo's table from pixel
+ *                value to palette color instead of choosing a palette
+ *                of its own, and swapping the two photos leaves the
+ *                palette unchanged.  The model keeps its table once
+ *                loaded; other photos keep none.  Must be called before
+ *                load_photo or start_photo_loaders.
+ *                Precompiled photos already have a palette and ignore
+ *                the model, and a precompiled model(which has no such
+ *                table) leaves the photo to choose its own palette.
+ *   INPUTS: p -- the photo(opened with open_photo)
+ *           model -- the photo whose palette is used; must not itself
+ *                    share a palette with p
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+photo_share_palette (photo_t* p, photo_t* model)
+{
+    p->model = model;
+    model->is_model = 1;
+}
+
+
+/* 
+ * photo_ctx_create
+ *   DESCRIPTION: Create a photo decoding context for a thread that loads
+ *                photos(see load_photo).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the new context, or NULL on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the context
+ */
+photo_ctx_t*
+photo_ctx_create ()
+{
+    return malloc (sizeof (photo_ctx_t));
+}
+
+
+/* 
+ * photo_ctx_destroy
+ *   DESCRIPTION: Release a photo decoding context.
+ *   INPUTS: ctx -- the context(may be NULL)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees the context
+ */
+void
+photo_ctx_destroy (photo_ctx_t* ctx)
+{
+    free (ctx);
+}
+
+
+/* 
+ * quantize_photo
+ *   DESCRIPTION: Read pixel data in 5:6:5 RGB format from a photo's file,
+ *                select the optimized palette for the photo, and map the
+ *                pixels into the palette colors.  Called by load_photo.
+ *   INPUTS: p -- the photo(header already read)
+ *           ctx -- decoding context(scratch space)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the pixels(and, for
+ *                 a model, the table from pixel to palette color)
+ */
+static int32_t
+quantize_photo (photo_t* p, photo_ctx_t* ctx)
+{
+    photo_header_t hdr;   /* header read with the pixels */
+    uint16_t* pixels_array; /* all pixels, top row first  */
+    uint8_t* lut;         /* table from pixel to palette */
+
+    /* 
+     * A photo that shares another photo's palette needs that photo's
+     * table, so load it first(before using the context for this photo).
+     */
+    if (NULL != p->model && 0 != load_photo (p->model, ctx)) {
+        return -1;
+    }
+
+    /* 
+     * Read the pixels into the context(checking that the file still
+     * matches the header read by open_photo) and allocate space to hold
+     * the photo pixels.  Photos are quantized only once(when loaded from
+     * PHOTO_PENDING).  If anything fails, clean up as necessary and
+     * return -1.
+     */
+    if (NULL == (pixels_array = read_image_file (p->fname, &hdr, 
+                    sizeof (pixels_array[0]), MAX_PHOTO_WIDTH, MAX_PHOTO_HEIGHT,
+                    ctx->pixels)) ||
+        hdr.width != p->hdr.width || hdr.height != p->hdr.height ||
+        NULL == (p->img = malloc 
+         (p->hdr.width * p->hdr.height * sizeof (p->img[0])))) {
+        return -1;
+    }
+
+    /* 
+     * With a shared palette, the photo uses the model's table from pixel
+     * value to palette color(rather than a copy of it), and mapping the
+     * pixels is all that remains.  A precompiled model has no table, so
+     * the photo then gets a palette of its own.  A photo that is itself
+     * a model passes the table on.
+     */
+    if (NULL != p->model && NULL != p->model->lut) {
+        memcpy (p->palette, p->model->palette, sizeof (p->palette));
+        if (p->is_model) {
+            p->lut = p->model->lut;
+        }
+        quantize_remap (p->model->lut, pixels_array, p->img, 
+                        p->hdr.width * p->hdr.height);
+        return 0;
+    }
+
+    /* 
+     * Otherwise build the table: models keep theirs for the photos that
+     * share their palettes, and other photos use the context's.
+     */
+    lut = ctx->lut;
+    if (p->is_model) {
+        if (NULL == (p->lut = malloc (QUANT_LUT_SIZE))) {
+            free (p->img);
+            p->img = NULL;
+            return -1;
+        }
+        lut = p->lut;
+    }
+    quantize_pixels (&ctx->q, pixels_array, p->hdr.width * p->hdr.height,
+                     p->palette, lut, p->img);
+    return 0;
+}
+
+
+/* 
+ * read_precompiled_photo
+ *   DESCRIPTION: Read the palette and pixel data of a precompiled photo
+ *                (see photo_headers.h).  The pixels are already palette
+ *                colors in top-to-bottom order, so they are copied as
+ *                they are.  Called by load_photo.
+ *   INPUTS: p -- the photo(header already read)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure(including files that
+ *                 no longer match the header or are too short to hold
+ *                 all of the pixels)
+ *   SIDE EFFECTS: dynamically allocates memory for the pixels, unless
+ *                 the photo is in the asset pack, in which case its
+ *                 pixels are not copied
+ */
+static int32_t
+read_precompiled_photo (photo_t* p)
+{
+    photo_precomp_header_t hdr;     /* header read with the pixels  */
+    asset_t                a;       /* file contents                */
+    size_t                 n;       /* number of pixels             */
+
+    if (0 != get_asset (p->fname, &a)) {
+        return -1;
+    }
+    if (sizeof (hdr) > a.len) {
+        put_asset (&a);
+        return -1;
+    }
+    memcpy (&hdr, a.data, sizeof (hdr));
+    n = (size_t)p->hdr.width * p->hdr.height;
+    if (0 != memcmp (hdr.magic, PHOTO_PRECOMP_MAGIC, sizeof (hdr.magic)) ||
+        hdr.hdr.width != p->hdr.width || hdr.hdr.height != p->hdr.height ||
+        sizeof (hdr) + n > a.len) {
+        put_asset (&a);
+        return -1;
+    }
+    memcpy (p->palette, hdr.palette, sizeof (p->palette));
+
+    /* Pixels in the pack are used where they are(never written). */
+    if (a.in_pack) {
+        p->img = (uint8_t*)(a.data + sizeof (hdr));
+        return 0;
+    }
+    if (NULL == (p->img = malloc (n * sizeof (p->img[0])))) {
+        put_asset (&a);
+        return -1;
+    }
+    memcpy (p->img, a.data + sizeof (hdr), n);
+
+    put_asset (&a);
+    return 0;
+}
+
+
+/*
+ *map_to_octree
+ *Description: helper function that convert the 16 bit RGB value to map to level 2 or level 4 nodes
+ *              only takes the first x bits from each R,G,B and get them togeter
+ *Input: pixel: the 16 bit pixel (5:6:5)  of RGB
+ *       level_number: 2 or 4, indicate which level of octree does the pixel map to
+ *Output: None
+ *Return Value: the position in array_2 or array_4, for array_2, it only occupies the last 6 bits
+          for array_4, it occupies the last 12 bits
+ *Side Effects: None
+ */
+uint16_t map_to_octree (const uint16_t pixel, const uint8_t level_number)
+{
+    if(level_number != rep_level_2 && level_number != rep_level_4)
+        return -1;
+    uint16_t pixel_copy = pixel;
+    if(level_number == rep_level_2)
+    {
+        return (((pixel_copy >> shift_14) << shift_4) | (((pixel_copy >> shift_9) & mask_3) << shift_2) | ((pixel_copy >> shift_3) & mask_3));
+    }
+    else
+    {
+        return (((pixel_copy >> shift_12) << shift_8) | (((pixel_copy >> shift_7) & mask_000f) << shift_4) | ((pixel_copy >> 1) & mask_000f));
+    }   
+}
+
+
+#ifdef PHOTO_BENCHMARK_PROGRAM
+
+/*
+ * Photo decoding microbenchmarks.  Build photo.c with
+ * -DPHOTO_BENCHMARK_PROGRAM and link with quantize.c, bench.c, modex.c,
+ * text.c, world.c, and assert.c(the benchmark does not use the other
+ * modules, but photo.c refers to them).
+ */
+
+#include "bench.h"
+
+#define BENCH_RUNS 50   /* timed runs of each variant */
+
+/*
+ * The level 4 histogram as it was kept before: one structure per node
+ * (about 80 bytes on 64-bit machines), used here as a reference.
+ */
+struct octree_node_level4 {
+        uint16_t    idx_level_2;
+        unsigned long int   red_sum;
+        unsigned long int   green_sum;
+        unsigned long int   blue_sum;
+        unsigned int pixel_number;
+        uint16_t    palette_idx;
+        unsigned long int   red_average;
+        unsigned long int   green_average;
+        unsigned long int   blue_average;
+};
+
+static struct octree_node_level4 bench_level_4[level_4_size];
+
+
+/*
+ * build_histogram_aos
+ *   DESCRIPTION: Reference histogram pass using one structure per node.
+ *   INPUTS: pixels -- 5:6:5 RGB pixels
+ *           n_pixels -- number of pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills bench_level_4
+ */
+static void
+build_histogram_aos (const uint16_t* pixels, uint32_t n_pixels)
+{
+    uint32_t i;     /* index over pixels        */
+    uint32_t n;     /* level 4 node of a pixel  */
+    uint16_t pixel; /* one pixel                */
+
+    for (i = 0; level_4_size > i; i++) {
+        bench_level_4[i].idx_level_2 = init_100;
+        bench_level_4[i].red_sum = 0;
+        bench_level_4[i].green_sum = 0;
+        bench_level_4[i].blue_sum = 0;
+        bench_level_4[i].pixel_number = 0;
+        bench_level_4[i].palette_idx = init_neg1;
+    }
+    for (i = 0; n_pixels > i; i++) {
+        pixel = pixels[i];
+        n = map_to_octree (pixel, rep_level_4);
+        bench_level_4[n].idx_level_2 = map_to_octree (pixel, rep_level_2);
+        bench_level_4[n].red_sum += (pixel >> shift_11) & mask_1f;
+        bench_level_4[n].green_sum += (pixel >> shift_5) & mask_3f;
+        bench_level_4[n].blue_sum += pixel & mask_1f;
+        bench_level_4[n].pixel_number++;
+    }
+}
+
+
+/* 
+ * draw_image_row_ref
+ *   DESCRIPTION: Reference object row compositing, testing each pixel
+ *                for transparency(as fill_horiz_buffer did before
+ *                images kept runs).  Arguments as for draw_image_row.
+ *   INPUTS: im, imgy, dx, buf, len -- see draw_image_row
+ *   OUTPUTS: buf -- opaque pixels overwritten
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+draw_image_row_ref (const image_t* im, int32_t imgy, int32_t dx, uint8_t* buf,
+                    int32_t len)
+{
+    int32_t idx;   /* index over buffer  */
+    int32_t imgx;  /* index over image   */
+    uint8_t pixel; /* pixel from image   */
+
+    idx = (0 < dx ? dx : 0);
+    imgx = idx - dx;
+    for (; len > idx && im->hdr.width > imgx; idx++, imgx++) {
+        pixel = im->img[imgy * im->hdr.width + imgx];
+        if (OBJ_CLR_TRANSP != pixel) {
+            buf[idx] = pixel;
+        }
+    }
+}
+
+
+/* 
+ * draw_image_col_ref
+ *   DESCRIPTION: Reference object column compositing, testing each pixel
+ *                for transparency(as fill_vert_buffer did before images
+ *                kept runs).  Arguments as for draw_image_col.
+ *   INPUTS: im, imgx, dy, buf, len -- see draw_image_col
+ *   OUTPUTS: buf -- opaque pixels overwritten
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+draw_image_col_ref (const image_t* im, int32_t imgx, int32_t dy, uint8_t* buf,
+                    int32_t len)
+{
+    int32_t idx;   /* index over buffer  */
+    int32_t imgy;  /* index over image   */
+    uint8_t pixel; /* pixel from image   */
+
+    idx = (0 < dy ? dy : 0);
+    imgy = idx - dy;
+    for (; len > idx && im->hdr.height > imgy; idx++, imgy++) {
+        pixel = im->img[imgy * im->hdr.width + imgx];
+        if (OBJ_CLR_TRANSP != pixel) {
+            buf[idx] = pixel;
+        }
+    }
+}
+
+
+/* 
+ * bench_object
+ *   DESCRIPTION: Time compositing every row and every column of an object
+ *                image into line buffers(at several offsets, including
+ *                partly off the buffer), testing each pixel and copying
+ *                runs, and check that the two agree.  Objects that
+ *                cannot be read are skipped.
+ *   INPUTS: out -- file for machine-readable results
+ *           fname -- object image file
+ *           run -- name of the benchmark run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: prints results; panics if the results differ
+ */
+static void
+bench_object (FILE* out, const char* fname, const char* run)
+{
+    static const int32_t offsets[] = {-40, 0, 17, 250, 300}; /* positions */
+    const int32_t n_offsets = sizeof (offsets) / sizeof (offsets[0]);
+    uint8_t        ref[SCROLL_X_DIM];   /* buffer drawn per pixel   */
+    uint8_t        line[SCROLL_X_DIM];  /* buffer drawn by runs     */
+    bench_stage_t  stage[4];            /* timings                  */
+    image_t*       im;                  /* the object image         */
+    uint64_t       start;               /* start time of a pass     */
+    int32_t        i;                   /* index over runs          */
+    int32_t        j;                   /* index over offsets       */
+    int32_t        k;                   /* index over rows/columns  */
+
+    if (NULL == (im = read_obj_image (fname))) {
+        printf ("run=%s skipped(cannot read %s)\n", run, fname);
+        return;
+    }
+    if (0 != bench_stage_init (&stage[0], "obj_row_pixel", BENCH_RUNS) ||
+        0 != bench_stage_init (&stage[1], "obj_row_runs", BENCH_RUNS) ||
+        0 != bench_stage_init (&stage[2], "obj_col_pixel", BENCH_RUNS) ||
+        0 != bench_stage_init (&stage[3], "obj_col_runs", BENCH_RUNS)) {
+        PANIC ("benchmark setup failed");
+    }
+    for (i = 0; BENCH_RUNS > i; i++) {
+        start = bench_now_ns ();
+        for (j = 0; n_offsets > j; j++) {
+            for (k = 0; im->hdr.height > k; k++) {
+                draw_image_row_ref (im, k, offsets[j], ref, SCROLL_X_DIM);
+            }
+        }
+        bench_stage_add (&stage[0], bench_now_ns () - start);
+        start = bench_now_ns ();
+        for (j = 0; n_offsets > j; j++) {
+            for (k = 0; im->hdr.height > k; k++) {
+                draw_image_row (im, k, offsets[j], line, SCROLL_X_DIM);
+            }
+        }
+        bench_stage_add (&stage[1], bench_now_ns () - start);
+        start = bench_now_ns ();
+        for (j = 0; n_offsets > j; j++) {
+            for (k = 0; im->hdr.width > k; k++) {
+                draw_image_col_ref (im, k, offsets[j] / 2, ref, SCROLL_Y_DIM);
+            }
+        }
+        bench_stage_add (&stage[2], bench_now_ns () - start);
+        start = bench_now_ns ();
+        for (j = 0; n_offsets > j; j++) {
+            for (k = 0; im->hdr.width > k; k++) {
+                draw_image_col (im, k, offsets[j] / 2, line, SCROLL_Y_DIM);
+            }
+        }
+        bench_stage_add (&stage[3], bench_now_ns () - start);
+        for (k = 0; 4 > k; k++) {
+            bench_stage_end_frame (&stage[k]);
+        }
+    }
+
+    /* Check each row and column separately against the reference. */
+    for (j = 0; n_offsets > j; j++) {
+        for (k = 0; im->hdr.height > k; k++) {
+            memset (ref, 0, sizeof (ref));
+            memset (line, 0, sizeof (line));
+            draw_image_row_ref (im, k, offsets[j], ref, SCROLL_X_DIM);
+            draw_image_row (im, k, offsets[j], line, SCROLL_X_DIM);
+            if (0 != memcmp (ref, line, SCROLL_X_DIM)) {
+                PANIC ("object rows differ");
+            }
+        }
+        for (k = 0; im->hdr.width > k; k++) {
+            memset (ref, 0, sizeof (ref));
+            memset (line, 0, sizeof (line));
+            draw_image_col_ref (im, k, offsets[j] / 2, ref, SCROLL_Y_DIM);
+            draw_image_col (im, k, offsets[j] / 2, line, SCROLL_Y_DIM);
+            if (0 != memcmp (ref, line, SCROLL_Y_DIM)) {
+                PANIC ("object columns differ");
+            }
+        }
+    }
+
+    for (k = 0; 4 > k; k++) {
+        bench_report (stdout, run, &stage[k]);
+        bench_report (out, run, &stage[k]);
+        bench_stage_free (&stage[k]);
+    }
+}
+
+/* 
+ * bench_layouts
+ *   DESCRIPTION: Time reading the lines of a screen-sized window of a
+ *                room photo at several places in the photo, with the
+ *                photo stored row by row, column by column(see
+ *                transpose_photo) and tile by tile(see tile_photo): rows
+ *                from the rows and the tiles, and columns from the rows,
+ *                the column copy and the tiles.  Checks that the layouts
+ *                give the same lines.
+ *   INPUTS: out -- file for machine-readable results
+ *           img -- pixels of the photo, row by row
+ *           w, h -- photo width and height(at least the window size)
+ *           run -- name of the run for the results
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: prints results and writes them to the file
+ */
+static void
+bench_layouts (FILE* out, uint8_t* img, int32_t w, int32_t h, 
+               const char* run)
+{
+    static const char* const names[5] = {
+        "row_rowmajor", "row_tiled", "col_rowmajor", "col_transposed", 
+        "col_tiled"
+    };
+    uint8_t        line[3][SCROLL_X_DIM]; /* lines read from each layout */
+    int32_t        view[4][2];          /* window positions         */
+    photo_t        rows;                /* row-by-row photo         */
+    photo_t        cols;                /* photo with column copy   */
+    photo_t        tiles;               /* tiled photo              */
+    bench_stage_t  stage[5];            /* timings                  */
+    uint64_t       start;               /* start time of a pass     */
+    int32_t        i;                   /* index over runs/stages   */
+    int32_t        j;                   /* index over positions     */
+    int32_t        k;                   /* index over lines         */
+
+    view[0][0] = 0;                 view[0][1] = 0;
+    view[1][0] = w / 3 + 5;         view[1][1] = h / 4 + 3;
+    view[2][0] = w / 2 - 7;         view[2][1] = h / 2 + 11;
+    view[3][0] = w - SCROLL_X_DIM;  view[3][1] = h - SCROLL_Y_DIM;
+
+    memset (&rows, 0, sizeof (rows));
+    rows.hdr.width = w;
+    rows.hdr.height = h;
+    rows.img = img;
+    cols = rows;
+    tiles = rows;
+    if (NULL == (cols.col_img = malloc ((size_t)w * h)) ||
+        0 != tile_photo (&tiles)) {
+        PANIC ("benchmark setup failed");
+    }
+    for (k = 0; w * h > k; k++) {
+        cols.col_img[h * (k % w) + k / w] = img[k];
+    }
+    for (i = 0; 5 > i; i++) {
+        if (0 != bench_stage_init (&stage[i], names[i], BENCH_RUNS)) {
+            PANIC ("benchmark setup failed");
+        }
+    }
+
+    for (i = 0; BENCH_RUNS > i; i++) {
+        start = bench_now_ns ();
+        for (j = 0; 4 > j; j++) {
+            for (k = 0; SCROLL_Y_DIM > k; k++) {
+                read_photo_row (&rows, view[j][0], view[j][1] + k, line[0], 
+                                SCROLL_X_DIM);
+            }
+        }
+        bench_stage_add (&stage[0], bench_now_ns () - start);
+        start = bench_now_ns ();
+        for (j = 0; 4 > j; j++) {
+            for (k = 0; SCROLL_Y_DIM > k; k++) {
+                read_photo_row (&tiles, view[j][0], view[j][1] + k, line[0], 
+                                SCROLL_X_DIM);
+            }
+        }
+        bench_stage_add (&stage[1], bench_now_ns () - start);
+        start = bench_now_ns ();
+        for (j = 0; 4 > j; j++) {
+            for (k = 0; SCROLL_X_DIM > k; k++) {
+                read_photo_col (&rows, view[j][0] + k, view[j][1], line[0], 
+                                SCROLL_Y_DIM);
+            }
+        }
+        bench_stage_add (&stage[2], bench_now_ns () - start);
+        start = bench_now_ns ();
+        for (j = 0; 4 > j; j++) {
+            for (k = 0; SCROLL_X_DIM > k; k++) {
+                read_photo_col (&cols, view[j][0] + k, view[j][1], line[0], 
+                                SCROLL_Y_DIM);
+            }
+        }
+        bench_stage_add (&stage[3], bench_now_ns () - start);
+        start = bench_now_ns ();
+        for (j = 0; 4 > j; j++) {
+            for (k = 0; SCROLL_X_DIM > k; k++) {
+                read_photo_col (&tiles, view[j][0] + k, view[j][1], line[0], 
+                                SCROLL_Y_DIM);
+            }
+        }
+        bench_stage_add (&stage[4], bench_now_ns () - start);
+        for (k = 0; 5 > k; k++) {
+            bench_stage_end_frame (&stage[k]);
+        }
+    }
+
+    /* Check every line of every window, including ones off the edges. */
+    for (j = 0; 4 > j; j++) {
+        for (k = -1; SCROLL_Y_DIM >= k; k++) {
+            read_photo_row (&rows, view[j][0] - 9, view[j][1] + k, line[0], 
+                            SCROLL_X_DIM);
+            read_photo_row (&tiles, view[j][0] - 9, view[j][1] + k, line[1], 
+                            SCROLL_X_DIM);
+            if (0 != memcmp (line[0], line[1], SCROLL_X_DIM)) {
+                PANIC ("photo rows differ");
+            }
+        }
+        for (k = 0; SCROLL_X_DIM > k; k++) {
+            read_photo_col (&rows, view[j][0] + k, view[j][1] - 9, line[0], 
+                            SCROLL_Y_DIM);
+            read_photo_col (&cols, view[j][0] + k, view[j][1] - 9, line[1], 
+                            SCROLL_Y_DIM);
+            read_photo_col (&tiles, view[j][0] + k, view[j][1] - 9, line[2], 
+                            SCROLL_Y_DIM);
+            if (0 != memcmp (line[0], line[1], SCROLL_Y_DIM) ||
+                0 != memcmp (line[0], line[2], SCROLL_Y_DIM)) {
+                PANIC ("photo columns differ");
+            }
+        }
+    }
+
+    for (k = 0; 5 > k; k++) {
+        bench_report (stdout, run, &stage[k]);
+        bench_report (out, run, &stage[k]);
+        bench_stage_free (&stage[k]);
+    }
+    free (cols.col_img);
+    free (tiles.tiles);
+}
+
+
+/* 
+ * show_status(interface function; declared in world.h)
+ *   DESCRIPTION: Stands in for the game's status messages, which world.c
+ *                uses; the benchmark has no status bar.
+ *   INPUTS: s -- the string used for the status message(ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+show_status (const char* s)
+{
+}
+
+
+/* 
+ * main
+ *   DESCRIPTION: Time the level 4 histogram pass over a synthetic photo
+ *                of the largest size, using the old array of structures
+ *                and the current structure of arrays, and the mapping of
+ *                pixels to palette colors, with a map_to_octree call per
+ *                pixel and with a table(quantize_build_lut and
+ *                quantize_remap).  Then time reading the lines of the
+ *                resulting photo in each layout(see bench_layouts), and
+ *                object compositing for
+ *                images/bunnysuit.obj and images/tux.obj(see
+ *                bench_object) if run from the game directory.  Checks
+ *                that the variants agree.  Results are printed and
+ *                written to bench_output.txt.
+ *   INPUTS: none(command line arguments are ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, 3 in panic situations
+ */
+int
+main ()
+{
+    static uint16_t pixels[MAX_PHOTO_WIDTH * MAX_PHOTO_HEIGHT];
+    const uint32_t n_pixels = MAX_PHOTO_WIDTH * MAX_PHOTO_HEIGHT;
+    static uint8_t  img[MAX_PHOTO_WIDTH * MAX_PHOTO_HEIGHT];
+    static uint8_t  lut[QUANT_LUT_SIZE];
+    quantizer_t*    q = &default_ctx.q; /* octree scratch space */
+    bench_stage_t  aos;     /* array of structures timings   */
+    bench_stage_t  soa;     /* structure of arrays timings   */
+    bench_stage_t  remap_call; /* remap with map_to_octree   */
+    bench_stage_t  remap_lut;  /* remap with a table         */
+    FILE*          out;     /* machine-readable results      */
+    uint32_t       seed;    /* state of pseudo-random pixels */
+    uint32_t       i;       /* index over pixels/runs/nodes  */
+    uint64_t       start;   /* start time of a run           */
+
+    /* Make smooth gradients with some noise, as in a photo. */
+    for (i = 0, seed = 1; n_pixels > i; i++) {
+        seed = seed * 1103515245 + 12345;
+        pixels[i] = (((i % MAX_PHOTO_WIDTH) / 33 + (seed >> 29)) << shift_11 & 0xF800) |
+                    (((i / MAX_PHOTO_WIDTH) / 17 + (seed >> 27 & 3)) << shift_5 & 0x07E0) |
+                    (((i % MAX_PHOTO_WIDTH + i / MAX_PHOTO_WIDTH) / 65) & mask_1f);
+    }
+
+    if (0 != bench_stage_init (&aos, "histogram_aos", BENCH_RUNS) ||
+        0 != bench_stage_init (&soa, "histogram_soa", BENCH_RUNS) ||
+        0 != bench_stage_init (&remap_call, "remap_call", BENCH_RUNS) ||
+        0 != bench_stage_init (&remap_lut, "remap_lut", BENCH_RUNS) ||
+        NULL == (out = fopen ("bench_output.txt", "w"))) {
+        PANIC ("benchmark setup failed");
+    }
+    for (i = 0; BENCH_RUNS > i; i++) {
+        start = bench_now_ns ();
+        build_histogram_aos (pixels, n_pixels);
+        bench_stage_add (&aos, bench_now_ns () - start);
+        bench_stage_end_frame (&aos);
+
+        start = bench_now_ns ();
+        quantize_histogram (q, pixels, n_pixels);
+        bench_stage_add (&soa, bench_now_ns () - start);
+        bench_stage_end_frame (&soa);
+    }
+
+    /* Give each node a color and time mapping the pixels to colors. */
+    for (i = 0; level_4_size > i; i++) {
+        q->palette_idx[i] = i * 7;
+    }
+    for (i = 0; BENCH_RUNS > i; i++) {
+        uint32_t j; /* index over pixels */
+
+        start = bench_now_ns ();
+        for (j = 0; n_pixels > j; j++) {
+            img[j] = q->palette_idx[map_to_octree (pixels[j], rep_level_4)];
+        }
+        bench_stage_add (&remap_call, bench_now_ns () - start);
+        bench_stage_end_frame (&remap_call);
+
+        start = bench_now_ns ();
+        quantize_build_lut (q, lut);
+        quantize_remap (lut, pixels, img, n_pixels);
+        bench_stage_add (&remap_lut, bench_now_ns () - start);
+        bench_stage_end_frame (&remap_lut);
+    }
+    for (i = 0; n_pixels > i; i++) {
+        if (img[i] != q->palette_idx[map_to_octree (pixels[i], rep_level_4)]) {
+            PANIC ("remapped pixels differ");
+        }
+    }
+    for (i = 0; level_4_size > i; i++) {
+        if (bench_level_4[i].pixel_number != q->level_4.pixel_number[i] ||
+            bench_level_4[i].red_sum != q->level_4.red_sum[i] ||
+            bench_level_4[i].green_sum != q->level_4.green_sum[i] ||
+            bench_level_4[i].blue_sum != q->level_4.blue_sum[i]) {
+            PANIC ("histograms differ");
+        }
+    }
+
+    bench_report (stdout, "photo_1024x1024", &aos);
+    bench_report (stdout, "photo_1024x1024", &soa);
+    bench_report (stdout, "photo_1024x1024", &remap_call);
+    bench_report (stdout, "photo_1024x1024", &remap_lut);
+    bench_report (out, "photo_1024x1024", &aos);
+    bench_report (out, "photo_1024x1024", &soa);
+    bench_report (out, "photo_1024x1024", &remap_call);
+    bench_report (out, "photo_1024x1024", &remap_lut);
+    bench_layouts (out, img, MAX_PHOTO_WIDTH, MAX_PHOTO_HEIGHT, 
+                   "photo_1024x1024");
+    bench_object (out, "images/bunnysuit.obj", "bunnysuit");
+    bench_object (out, "images/tux.obj", "tux");
+    (void)fclose (out);
+    bench_stage_free (&aos);
+    bench_stage_free (&soa);
+    bench_stage_free (&remap_call);
+    bench_stage_free (&remap_lut);
+    return 0;
+}
 
+#endif /* PHOTO_BENCHMARK_PROGRAM */
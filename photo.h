@@ -39,10 +39,12 @@
 
 
 #include <stdint.h>
+#include <stdio.h>
 
 #include "types.h"
 #include "modex.h"
 #include "photo_headers.h"
+#include "quantize.h"
 #include "world.h"
 
 
@@ -51,30 +53,6 @@
 #define MAX_PHOTO_HEIGHT  1024
 #define MAX_OBJECT_WIDTH  160
 #define MAX_OBJECT_HEIGHT 100
-#define level_4_size		4096 //size of level 4
-#define first_128		128 //the first 128 colors
-#define level_2_size		64 //size of level 2
-#define old_64		64 //size for the colors of objects and status bar
-#define init_100    100 //for initialization
-#define init_neg1   -1 //for index initialization
-#define rep_level_4 4 //representing level 4
-#define rep_level_2 2 //representing level 2
-#define shift_11 11//for shifting
-#define mask_3 0x3
-#define mask_1f 0x001F //for bitmask
-#define mask_3f 0x003F 
-#define mask_000f 0x000F
-#define shift_5 5 //for bit shift
-#define shift_14 14
-#define shift_4 4
-#define shift_9 9
-#define shift_2 2
-#define shift_3 3
-#define shift_12 12
-#define shift_8 8
-#define shift_7 7
-
-
 
 
 /* Fill a buffer with the pixels for a horizontal line of current room. */
@@ -83,6 +61,16 @@ extern void fill_horiz_buffer(int x, int y, unsigned char buf[SCROLL_X_DIM]);
 /* Fill a buffer with the pixels for a vertical line of current room. */
 extern void fill_vert_buffer(int x, int y, unsigned char buf[SCROLL_Y_DIM]);
 
+/* Fill a buffer with the pixels for a rectangle of current room. */
+extern void fill_rect_buffer(int x, int y, int w, int h, unsigned char* buf,
+                             int stride);
+
+/*
+ * Write the memory used by column-by-column copies of room photos(made
+ * for drawing vertical lines) to a file as key=value pairs.
+ */
+extern void photo_transpose_report(FILE* f);
+
 /* Get height of object image in pixels. */
 extern uint32_t image_height(const image_t* im);
 
@@ -101,20 +89,44 @@ extern uint32_t photo_width(const photo_t* p);
  */
 extern void prep_room(const room_t* r);
 
+/*
+ * Map an asset pack holding photo and image files; returns 0 on
+ * success, -1 on failure(files are then read individually).
+ */
+extern int32_t open_asset_pack(const char* fname);
+
 /* Read object image from a file into a dynamically allocated structure. */
 extern image_t* read_obj_image(const char* fname);
 
 /* Read room photo from a file into a dynamically allocated structure. */
 extern photo_t* read_photo(const char* fname);
 
+/*
+ * Read room photo header from a file into a dynamically allocated
+ * structure; the palette and pixels are loaded later by load_photo.
+ */
+extern photo_t* open_photo(const char* fname);
+
+/*
+ * Load palette and pixels for an opened room photo, or wait for another
+ * thread to finish loading them.  Uses the decoding context ctx, or a
+ * shared one if ctx is NULL.  Returns 0 on success, -1 on failure.
+ */
+extern int32_t load_photo(photo_t* p, photo_ctx_t* ctx);
+
+/* Make a photo use another photo's palette(call before loading). */
+extern void photo_share_palette(photo_t* p, photo_t* model);
+
+/* Create and release photo decoding contexts(one per loading thread). */
+extern photo_ctx_t* photo_ctx_create(void);
+extern void photo_ctx_destroy(photo_ctx_t* ctx);
+
 void fill_palette(unsigned char my_palette[192][3]);
 
 
 extern uint16_t	map_to_octree (const uint16_t pixel, const uint8_t level_number);
 
 
-extern int qsort_helper(const void *a, const void *b);
-
 /*
  * N.B.  I'm aware that Valgrind and similar tools will report the fact that
  * I chose not to bother freeing image data before terminating the program.
@@ -81,4 +81,60 @@ struct photo_header_t {
     uint16_t height;    /* image height in pixels */
 };
 
+/* precompiled room photo magic sequence(before header) */
+#define PHOTO_PRECOMP_MAGIC "P8Q1"
+
+/*
+ * Precompiled room photo file header.  A precompiled photo has already
+ * been quantized(by mp2photo -q): the header is followed by one byte
+ * per pixel giving the palette color(64 to 255), stored starting from
+ * the upper left of the image and scanning across each row, with rows
+ * from top to bottom.  No padding is used.  The magic sequence read as
+ * a photo_header_t gives a width far above any allowed width, so the
+ * two formats cannot be confused.
+ */
+typedef struct photo_precomp_header_t photo_precomp_header_t;
+struct photo_precomp_header_t {
+    char           magic[4];        /* PHOTO_PRECOMP_MAGIC(no NUL)  */
+    photo_header_t hdr;             /* image width and height       */
+    uint8_t        palette[192][3]; /* 6-bit RGB for colors 64-255  */
+};
+
+/* asset pack magic sequence(start of header) */
+#define ASSET_PACK_MAGIC "ADVPACK1"
+
+#define ASSET_NAME_LEN 48      /* longest asset name, including NUL   */
+#define ASSET_ALIGN    8       /* alignment of asset data in the pack */
+
+/* asset flags */
+#define ASSET_TOP_DOWN 0x1     /* pixel rows stored from top to bottom */
+
+/*
+ * Asset pack(world.pack) file header.  An asset pack holds the room
+ * photo and object image files of a world in one file, built by
+ * mp2photo -p.  The header is followed by a table of contents with one
+ * entry per asset, sorted by name(strcmp order), and then by the
+ * assets themselves, each starting on an ASSET_ALIGN boundary.  Assets
+ * are named by the file names used to load them(for example,
+ * "images/allerton.photo").  Room photos and object images whose rows
+ * have been reordered from top to bottom are marked ASSET_TOP_DOWN;
+ * their headers are unchanged.  Precompiled photos are stored as they
+ * are.
+ */
+typedef struct asset_pack_header_t asset_pack_header_t;
+struct asset_pack_header_t {
+    char     magic[8];      /* ASSET_PACK_MAGIC(no NUL)     */
+    uint32_t n_entries;     /* entries in table of contents */
+    uint32_t reserved;      /* zero                         */
+};
+
+typedef struct asset_pack_entry_t asset_pack_entry_t;
+struct asset_pack_entry_t {
+    char     name[ASSET_NAME_LEN]; /* asset name(NUL-terminated)      */
+    uint32_t offset;               /* start of asset from start of file */
+    uint32_t length;               /* asset length in bytes            */
+    uint32_t flags;                /* ASSET_* flags                    */
+    uint32_t reserved;             /* zero                             */
+};
+
 #endif /* PHOTO_HEADERS_H */
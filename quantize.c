@@ -0,0 +1,305 @@
+/* tab:4
+ *
+ * quantize.c - octree color quantization of room photos
+ *
+ * Filename:      quantize.c
+ * History:
+ *    1    Extracted from photo.c so that mp2photo can precompile photos.
+ */
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "quantize.h"
+
+
+/*
+ * Level 4 octree node for a 5:6:5 pixel, as computed by map_to_octree:
+ * the top four bits of each color, packed as red:green:blue.
+ */
+#define LEVEL_4_NODE(pixel) \
+    ((((pixel) >> 4) & 0x0F00) | (((pixel) >> 3) & 0x00F0) | (((pixel) >> 1) & 0x000F))
+
+/* local functions--see function headers for details */
+static void level_4_nodes (const uint16_t* pixels, uint16_t* nodes,
+                           uint32_t n_pixels);
+static void sort_level_4 (const uint32_t pixel_number[level_4_size],
+                          uint16_t order[level_4_size],
+                          uint16_t tmp[level_4_size]);
+
+
+/*
+ * quantize_pixels
+ *   DESCRIPTION: Select the optimized palette for a photo and map its
+ *                pixels into the palette colors.
+ *   INPUTS: q -- quantizer(scratch space)
+ *           pixels -- 5:6:5 RGB pixels
+ *           n_pixels -- number of pixels
+ *   OUTPUTS: palette -- the 192 palette colors(VGA colors 64 to 255)
+ *            lut -- palette color for each 5:6:5 pixel value
+ *            img -- palette color for each pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+quantize_pixels (quantizer_t* q, const uint16_t* pixels, uint32_t n_pixels,
+                 uint8_t palette[192][3], uint8_t lut[QUANT_LUT_SIZE],
+                 uint8_t* img)
+{
+    quantize_histogram (q, pixels, n_pixels);
+    quantize_palette (q, palette);
+    quantize_build_lut (q, lut);
+    quantize_remap (lut, pixels, img, n_pixels);
+}
+
+
+/*
+ * quantize_palette
+ *   DESCRIPTION: Select the palette from a level 4 histogram built by
+ *                quantize_histogram.  The 128 level 4 nodes with the most
+ *                pixels get colors of their own; the remaining nodes are
+ *                merged into their level 2 parents, which get the other
+ *                64 colors.  Each color is the average of its pixels.
+ *   INPUTS: q -- quantizer holding the level 4 histogram
+ *   OUTPUTS: palette -- the 192 palette colors(VGA colors 64 to 255)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: records the VGA color of each level 4 node in q
+ */
+void
+quantize_palette (quantizer_t* q, uint8_t palette[192][3])
+{
+    octree_hist_t* level_4 = &q->level_4;    //8^4 nodes
+    octree_hist_t* level_2 = &q->level_2;    //8^2 nodes
+    uint16_t* order = q->order;
+    uint32_t    i;
+    uint32_t    n; //index of a node
+    uint32_t    l2; //index of a level 2 node
+    uint32_t    cnt; //pixels in a node
+
+    //order level 4 nodes by pixel count to get the first 128 colors
+    sort_level_4 (level_4->pixel_number, order, q->order_tmp);
+
+    //fill the palette for the 128 colors with average rgb(black if empty)
+    for(i = 0; i < first_128; i++)
+    {
+        n = order[i];
+        cnt = level_4->pixel_number[n];
+        palette[i][0] = cnt ? ((level_4->red_sum[n] / cnt) & 0x1F) << 1 : 0;
+        palette[i][1] = cnt ? (level_4->green_sum[n] / cnt) & 0x3F : 0;
+        palette[i][2] = cnt ? ((level_4->blue_sum[n] / cnt) & 0x1F) << 1 : 0;
+        q->palette_idx[n] = old_64 + i;
+    }
+
+    /*
+     *add the remaining level 4 nodes into their level 2 parents, which
+     *are named by the top two bits of each color(the top two of the four
+     *bits used for level 4)
+     */
+    memset (level_2->red_sum, 0, level_2_size * sizeof (level_2->red_sum[0]));
+    memset (level_2->green_sum, 0, level_2_size * sizeof (level_2->green_sum[0]));
+    memset (level_2->blue_sum, 0, level_2_size * sizeof (level_2->blue_sum[0]));
+    memset (level_2->pixel_number, 0, level_2_size * sizeof (level_2->pixel_number[0]));
+    for(i = first_128; i < level_4_size; i++)
+    {
+        n = order[i];
+        l2 = (((n >> 10) & mask_3) << shift_4) | (((n >> 6) & mask_3) << shift_2) |
+             ((n >> 2) & mask_3);
+        level_2->red_sum[l2] += level_4->red_sum[n];
+        level_2->green_sum[l2] += level_4->green_sum[n];
+        level_2->blue_sum[l2] += level_4->blue_sum[n];
+        level_2->pixel_number[l2] += level_4->pixel_number[n];
+        q->palette_idx[n] = old_64 + first_128 + l2;
+    }
+
+    //fill the palette for the second 64 colors with average rgb
+    for(i = 0; i < level_2_size; i++)
+    {
+        cnt = level_2->pixel_number[i];
+        palette[i+first_128][0] = cnt ? ((level_2->red_sum[i] / cnt) & 0x1F) << 1 : 0;
+        palette[i+first_128][1] = cnt ? (level_2->green_sum[i] / cnt) & 0x3F : 0;
+        palette[i+first_128][2] = cnt ? ((level_2->blue_sum[i] / cnt) & 0x1F) << 1 : 0;
+    }
+}
+
+
+/*
+ * level_4_nodes
+ *   DESCRIPTION: Find the level 4 octree node(see map_to_octree) for each
+ *                of a span of pixels.  Uses SSE2 to handle eight pixels
+ *                at a time when available, and plain C otherwise.  (Level
+ *                2 nodes are derived from level 4 nodes as needed.)
+ *   INPUTS: pixels -- 5:6:5 RGB pixels
+ *           n_pixels -- number of pixels
+ *   OUTPUTS: nodes -- level 4 node of each pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+level_4_nodes (const uint16_t* pixels, uint16_t* nodes, uint32_t n_pixels)
+{
+    uint32_t i = 0; /* index over pixels */
+
+#ifdef __SSE2__
+    const __m128i red = _mm_set1_epi16 (0x0F00);   /* red bits of node   */
+    const __m128i green = _mm_set1_epi16 (0x00F0); /* green bits of node */
+    const __m128i blue = _mm_set1_epi16 (0x000F);  /* blue bits of node  */
+    __m128i       p;                               /* eight pixels       */
+
+    for (; n_pixels >= i + 8; i += 8) {
+        p = _mm_loadu_si128 ((const __m128i*)(pixels + i));
+        p = _mm_or_si128 (_mm_or_si128 (
+                _mm_and_si128 (_mm_srli_epi16 (p, 4), red),
+                _mm_and_si128 (_mm_srli_epi16 (p, 3), green)),
+                _mm_and_si128 (_mm_srli_epi16 (p, 1), blue));
+        _mm_storeu_si128 ((__m128i*)(nodes + i), p);
+    }
+#endif
+    for (; n_pixels > i; i++) {
+        nodes[i] = LEVEL_4_NODE (pixels[i]);
+    }
+}
+
+
+/*
+ * quantize_histogram
+ *   DESCRIPTION: Count the pixels in each level 4 octree node and sum
+ *                their red, green, and blue values.  Nodes are found for
+ *                QUANT_SPAN pixels at a time with level_4_nodes.
+ *   INPUTS: q -- quantizer(scratch space)
+ *           pixels -- 5:6:5 RGB pixels
+ *           n_pixels -- number of pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills the level 4 histogram in q
+ */
+void
+quantize_histogram (quantizer_t* q, const uint16_t* pixels, uint32_t n_pixels)
+{
+    octree_hist_t* h = &q->level_4; /* the level 4 histogram */
+    uint16_t* nodes = q->node_idx;  /* nodes of a span       */
+    uint32_t i;     /* index over pixels        */
+    uint32_t j;     /* index over span          */
+    uint32_t len;   /* pixels in span           */
+    uint32_t n;     /* level 4 node of a pixel  */
+    uint16_t pixel; /* one pixel                */
+
+    memset (h, 0, sizeof (*h));
+    for (i = 0; n_pixels > i; i += len) {
+        len = (n_pixels - i < QUANT_SPAN ? n_pixels - i : QUANT_SPAN);
+        level_4_nodes (pixels + i, nodes, len);
+        for (j = 0; len > j; j++) {
+            pixel = pixels[i + j];
+            n = nodes[j];
+            h->red_sum[n] += pixel >> shift_11;
+            h->green_sum[n] += (pixel >> shift_5) & mask_3f;
+            h->blue_sum[n] += pixel & mask_1f;
+            h->pixel_number[n]++;
+        }
+    }
+}
+
+
+/*
+ * quantize_build_lut
+ *   DESCRIPTION: Build a table with the palette color for each of the
+ *                65536 possible 5:6:5 RGB pixel values, so that mapping
+ *                a pixel takes one lookup.
+ *   INPUTS: q -- quantizer holding the color of each level 4 node(see
+ *                quantize_palette)
+ *   OUTPUTS: lut -- palette color for each 5:6:5 pixel value
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+quantize_build_lut (const quantizer_t* q, uint8_t lut[QUANT_LUT_SIZE])
+{
+    uint32_t i; /* index over pixel values */
+
+    for (i = 0; QUANT_LUT_SIZE > i; i++) {
+        lut[i] = q->palette_idx[LEVEL_4_NODE (i)];
+    }
+}
+
+
+/*
+ * quantize_remap
+ *   DESCRIPTION: Map 5:6:5 RGB pixels into palette colors with a table
+ *                built by quantize_build_lut.
+ *   INPUTS: lut -- palette color for each 5:6:5 pixel value
+ *           pixels -- 5:6:5 RGB pixels
+ *           n_pixels -- number of pixels
+ *   OUTPUTS: img -- palette color for each pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+quantize_remap (const uint8_t lut[QUANT_LUT_SIZE], const uint16_t* pixels,
+                uint8_t* img, uint32_t n_pixels)
+{
+    uint32_t i; /* index over pixels */
+
+    for (i = 0; n_pixels > i; i++) {
+        img[i] = lut[pixels[i]];
+    }
+}
+
+
+/*
+ * sort_level_4
+ *   DESCRIPTION: Order the level 4 octree nodes by decreasing pixel count.
+ *                The nodes themselves are not moved; instead, their
+ *                indices are sorted with a stable least-significant-digit
+ *                radix sort on the count, so nodes with equal counts stay
+ *                in index order and the result is deterministic.  Three
+ *                8-bit digits cover counts up to 2^24, more than the
+ *                number of pixels in the largest photo.
+ *   INPUTS: pixel_number -- pixel counts of the level 4 nodes
+ *           tmp -- scratch space for level_4_size indices
+ *   OUTPUTS: order -- indices of level 4 nodes, most pixels first
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+sort_level_4 (const uint32_t pixel_number[level_4_size],
+              uint16_t order[level_4_size], uint16_t tmp[level_4_size])
+{
+    uint32_t  count[256]; /* digit counts, then starting positions */
+    uint16_t* src;        /* indices before this pass              */
+    uint16_t* dst;        /* indices after this pass               */
+    uint16_t* swap;       /* for exchanging src and dst            */
+    uint32_t  shift;      /* position of digit in count            */
+    uint32_t  sum;        /* running sum of counts                 */
+    uint32_t  digit;      /* digit of one node's count             */
+    uint32_t  i;          /* index over nodes and digits           */
+
+    /* Start with the nodes in index order(three passes end in order). */
+    for (i = 0; level_4_size > i; i++) {
+        tmp[i] = i;
+    }
+    src = tmp;
+    dst = order;
+
+    for (shift = 0; 24 > shift; shift += 8) {
+        /* Count digits of the inverted count(for decreasing order). */
+        memset (count, 0, sizeof (count));
+        for (i = 0; level_4_size > i; i++) {
+            count[((~pixel_number[src[i]]) >> shift) & 0xFF]++;
+        }
+        for (i = 0, sum = 0; 256 > i; i++) {
+            digit = count[i];
+            count[i] = sum;
+            sum += digit;
+        }
+        for (i = 0; level_4_size > i; i++) {
+            digit = ((~pixel_number[src[i]]) >> shift) & 0xFF;
+            dst[count[digit]++] = src[i];
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    /* After an odd number of passes, the result is in order already. */
+}
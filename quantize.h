@@ -0,0 +1,98 @@
+/* tab:4
+ *
+ * quantize.h - header file for octree color quantization of room photos
+ *
+ * Filename:      quantize.h
+ * History:
+ *    1    Extracted from photo.c so that mp2photo can precompile photos.
+ */
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+
+#include <stdint.h>
+
+
+/* octree sizes and bit manipulation constants */
+#define level_4_size		4096 //size of level 4
+#define first_128		128 //the first 128 colors
+#define level_2_size		64 //size of level 2
+#define old_64		64 //size for the colors of objects and status bar
+#define init_100    100 //for initialization
+#define init_neg1   -1 //for index initialization
+#define rep_level_4 4 //representing level 4
+#define rep_level_2 2 //representing level 2
+#define shift_11 11//for shifting
+#define mask_3 0x3
+#define mask_1f 0x001F //for bitmask
+#define mask_3f 0x003F
+#define mask_000f 0x000F
+#define shift_5 5 //for bit shift
+#define shift_14 14
+#define shift_4 4
+#define shift_9 9
+#define shift_2 2
+#define shift_3 3
+#define shift_12 12
+#define shift_8 8
+#define shift_7 7
+
+/* entries in a table from 5:6:5 pixel value to palette color */
+#define QUANT_LUT_SIZE 65536
+
+/* pixels whose octree nodes are found at a time */
+#define QUANT_SPAN 1024
+
+/*
+ * An octree histogram, kept as separate arrays of 32-bit sums and
+ * counts(structure of arrays) so that the per-pixel pass touches only
+ * 16 bytes per node; the level 4 histogram fits in 64kB.  Color sums are
+ * in 5:6:5 units: at most 2^20 pixels times 63 fits easily in 32 bits.
+ */
+typedef struct octree_hist_t octree_hist_t;
+struct octree_hist_t {
+    uint32_t red_sum[level_4_size];
+    uint32_t green_sum[level_4_size];
+    uint32_t blue_sum[level_4_size];
+    uint32_t pixel_number[level_4_size];
+};
+
+/*
+ * Scratch space for quantizing one photo.  Only one thread may use a
+ * quantizer at a time.
+ */
+typedef struct quantizer_t quantizer_t;
+struct quantizer_t {
+    octree_hist_t level_4;               /* 8^4 nodes(level 2 uses 64)    */
+    octree_hist_t level_2;               /* 8^2 nodes                     */
+    uint8_t  palette_idx[level_4_size];  /* VGA color for level 4 node    */
+    uint16_t node_idx[QUANT_SPAN];       /* level 4 nodes for a span      */
+    uint16_t order[level_4_size];        /* level 4 nodes by pixel count  */
+    uint16_t order_tmp[level_4_size];    /* scratch space for sorting     */
+};
+
+/* Count the 5:6:5 pixels in each level 4 octree node. */
+extern void quantize_histogram(quantizer_t* q, const uint16_t* pixels,
+                               uint32_t n_pixels);
+
+/*
+ * Select the 192 palette colors(VGA colors 64 to 255) from the
+ * histogram and record the color chosen for each level 4 node.
+ */
+extern void quantize_palette(quantizer_t* q, uint8_t palette[192][3]);
+
+/* Build a table from 5:6:5 pixel value to palette color. */
+extern void quantize_build_lut(const quantizer_t* q,
+                               uint8_t lut[QUANT_LUT_SIZE]);
+
+/* Map 5:6:5 pixels into palette colors with a table. */
+extern void quantize_remap(const uint8_t lut[QUANT_LUT_SIZE],
+                           const uint16_t* pixels, uint8_t* img,
+                           uint32_t n_pixels);
+
+/* Do all of the above for one photo. */
+extern void quantize_pixels(quantizer_t* q, const uint16_t* pixels,
+                            uint32_t n_pixels, uint8_t palette[192][3],
+                            uint8_t lut[QUANT_LUT_SIZE], uint8_t* img);
+
+#endif /* QUANTIZE_H */
@@ -33,6 +33,7 @@
  *        Integrated original release back into main code base.
  */
 
+#include <stdint.h>
 #include <string.h>
 #include "text.h"
 #include "modex.h"
@@ -562,34 +563,120 @@ unsigned char font_data[256][16] = {
      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
 };
 
+/* character cells across the status bar */
+#define STATUS_CELLS (total320 / colnumber)
+
+/* bytes in each row of a status bar plane */
+#define STATUS_ROW_BYTES (total320 / plane_num)
+
+/* two status bar pixels of one color, side by side in a plane */
+#define COLOR_PAIR(c) ((uint16_t)(((c) << 8) | (c)))
+
 /*
- * populate_text_buff
- *     DESCRIPTION: Populates the status_buff with the bits
- *     INPUTS: *msg         -- The string 
- *             start_pos     -- The starting position 
- * 
- *     OUTPUTS: A populated status_buff global var with the bits for the status bar
+ * Planar glyph cache.  A character drawn at a column that is a multiple
+ * of four covers two bytes of each plane in each of its rows: pixel p
+ * of the row in the first byte of plane p and pixel p + 4 in the
+ * second.  glyph_mask holds, for each character, row and plane, those
+ * two bytes with 0xFF for each foreground pixel and 0x00 for each
+ * background pixel, so a glyph row is drawn into a plane with a single
+ * two-byte read-modify-write.  Rows come from font rows 1 to 16, as the
+ * status bar has always drawn them(the last is the first row of the
+ * next character).  The cache is filled on first use.
+ */
+static uint16_t glyph_mask[256][row_num][plane_num];
+static int glyph_cache_ready = 0;
+
+/*
+ * Status bar render cache.  draw_status_bar keeps status_buff holding the
+ * bar last copied to video memory, and records here what it shows: either
+ * the centered status message in shown_msg, or, when shown_msg is empty,
+ * the room name and typed command.  Those two are recorded by character
+ * cell(8 pixels, or two bytes of each plane), giving the room name
+ * character and the typed command character drawn in each cell(or '\0'
+ * for none), so that a change in either redraws only the cells that
+ * differ.  status_drawn is 0 until the bar has been drawn once.
+ */
+static int  status_drawn = 0;
+static char shown_msg[STATUS_CELLS + 1];
+static char shown_room[STATUS_CELLS];
+static char shown_typed[STATUS_CELLS];
+
+static void build_glyph_cache(void);
+static void draw_glyph(unsigned char c, int x);
+static void draw_status_cell(int cell, char room_c, char typed_c);
+static void fix_status_dot(void);
+
+
+/*
+ * build_glyph_cache
+ *     DESCRIPTION: Fills glyph_mask from font_data.
+ *     INPUTS: None
+ *     OUTPUTS: glyph_mask
  *     RETURN VALUE: None
  *     SIDE EFFECTS: None
  */
-void populate_text_buff(const char *msg, int start_pos) { 
-    int current_char = 0, row = 0, col = 0, p_off = 0, bitmask;
-    for(current_char = 0; current_char < strlen(msg); current_char++) { // each char
-        for(row = 0; row < row_num; row++) { // row 
-            int update_row;
-            update_row=(row + 1)*total320/plane_num;
-            bitmask = mask;
-            for(col = 0; col < colnumber; col++, bitmask >>= 1) { // and for each col 
-                if(font_data[(int)msg[current_char]][row + 1] & bitmask) {
-                    int update_pos;
-                    update_pos=(start_pos + bitnumber * current_char + col)/plane4;
-                    p_off = col & and32;
-                    status_buff[p_off*total_planesize/plane4 + update_row + update_pos] = c3;    
-                }   
+static void build_glyph_cache(void) {
+    const unsigned char* font = &font_data[0][0];
+    int c, row, p, bits;
+    unsigned char pair[2];
+    for(c = 0; c < 256; c++) {
+        for(row = 0; row < row_num; row++) {
+            /* The last character has no next character to read. */
+            bits = 0;
+            if(c * FONT_HEIGHT + row + 1 < 256 * FONT_HEIGHT)
+                bits = font[c * FONT_HEIGHT + row + 1];
+            for(p = 0; p < plane_num; p++) {
+                pair[0] = ((bits & (mask >> p)) ? 0xFF : 0x00);
+                pair[1] = ((bits & (mask >> (p + plane4))) ? 0xFF : 0x00);
+                memcpy(&glyph_mask[c][row][p], pair, sizeof(pair));
             }
         }
     }
-    int column_index;
+    glyph_cache_ready = 1;
+}
+
+
+/*
+ * draw_glyph
+ *     DESCRIPTION: Draws the foreground pixels of one character into
+ *                  status_buff.  Background pixels are left unchanged.
+ *     INPUTS: c -- the character
+ *             x -- the column of its left edge(a multiple of 4 from 0
+ *                  to 312)
+ *     OUTPUTS: status_buff
+ *     RETURN VALUE: None
+ *     SIDE EFFECTS: None
+ */
+static void draw_glyph(unsigned char c, int x) {
+    unsigned char* dst;
+    uint16_t m, v;
+    int row, p;
+    if(!glyph_cache_ready)
+        build_glyph_cache();
+    for(p = 0; p < plane_num; p++) {
+        /* Glyphs start in the second row of the bar. */
+        dst = status_buff + p*total_planesize/plane4 + STATUS_ROW_BYTES + x/plane4;
+        for(row = 0; row < row_num; row++, dst += STATUS_ROW_BYTES) {
+            m = glyph_mask[c][row][p];
+            memcpy(&v, dst, sizeof(v));
+            v = (v & ~m) | (COLOR_PAIR(c3) & m);
+            memcpy(dst, &v, sizeof(v));
+        }
+    }
+}
+
+
+/*
+ * fix_status_dot
+ *     DESCRIPTION: Deletes the strange dot at the right end of the
+ *                  status bar, left by the last character cell.
+ *     INPUTS: None
+ *     OUTPUTS: status_buff
+ *     RETURN VALUE: None
+ *     SIDE EFFECTS: None
+ */
+static void fix_status_dot(void) {
+    int column_index, p_off;
     for(column_index = start312; column_index < total320; column_index++) {//delete the strange dot 
         p_off = column_index & and32;
         status_buff[p_off*total320*x18/plane_num + row_num*total320/plane_num + column_index/plane_num] = x05;
@@ -598,91 +685,150 @@ void populate_text_buff(const char *msg, int start_pos) {
 
 
 /*
- * write_room_name
- *     DESCRIPTION: write room name onto the status bar. 
- *     INPUTS: *msg         -- The string written to the status bar 
+ * populate_text_buff
+ *     DESCRIPTION: Populates the status_buff with the bits
+ *     INPUTS: *msg         -- The string 
+ *             start_pos     -- The starting position 
  * 
- *     OUTPUTS: None
+ *     OUTPUTS: A populated status_buff global var with the bits for the status bar
  *     RETURN VALUE: None
- *     SIDE EFFECTS: none
+ *     SIDE EFFECTS: None
  */
-
-void write_room_name(const char* msg) {  // text_to_graphic(msg, ROOM_NAME)
-    
-    populate_text_buff(msg, 0); 
-    //int i;
-    modex_helper();
-    /* for (i = 0; i < 4; i++) { 
-        SET_WRITE_MASK (1 << (i + 8));
-        memcpy(mem_image, status_buff + (i * 1440), 1440);  // 5760 / 4 = 1440
-    } */
-
-    return;
+void populate_text_buff(const char *msg, int start_pos) { 
+    int current_char, len = strlen(msg);
+    for(current_char = 0; current_char < len; current_char++) { // each char
+        draw_glyph((unsigned char)msg[current_char], start_pos + bitnumber * current_char);
+    }
+    fix_status_dot();
 }
 
+
 /*
- * write_status_message
- *     DESCRIPTION: write status message onto the status bar. 
- *     INPUTS: *msg         -- The string written to the status bar 
- * 
- *     OUTPUTS: None
+ * draw_status_cell
+ *     DESCRIPTION: Redraws one character cell of the status bar, with
+ *                  the room name and typed command characters that fall
+ *                  in it drawn over the background.
+ *     INPUTS: cell -- the cell(0 to STATUS_CELLS - 1)
+ *             room_c -- room name character, or '\0' for none
+ *             typed_c -- typed command character, or '\0' for none
+ *     OUTPUTS: status_buff
  *     RETURN VALUE: None
- *     SIDE EFFECTS: none
+ *     SIDE EFFECTS: None
  */
-void write_status_message(const char* msg) { // text_to_graphic(msg, STATUS_MSG);
-    memset(status_buff, x03, total_planesize);
-    populate_text_buff(msg, (total320 - colnumber * strlen(msg))/2); 
-    //int i;
-    modex_helper();
-    /* for (i = 0; i < 4; i++) { 
-        SET_WRITE_MASK (1 << (i + 8));
-        memcpy(mem_image, status_buff + (i * 1440), 1440);  // 5760 / 4 = 1440
-    } */
+static void draw_status_cell(int cell, char room_c, char typed_c) {
+    static const uint16_t no_glyph[row_num][plane_num];
+    const uint16_t (*room_g)[plane_num] = no_glyph;
+    const uint16_t (*typed_g)[plane_num] = no_glyph;
+    unsigned char* dst;
+    uint16_t m, v;
+    int row, p;
+    if(!glyph_cache_ready)
+        build_glyph_cache();
+    if('\0' != room_c)
+        room_g = glyph_mask[(unsigned char)room_c];
+    if('\0' != typed_c)
+        typed_g = glyph_mask[(unsigned char)typed_c];
 
-    return;
+    /*
+     * Both characters are drawn over the background, so each row of the
+     * cell is stored without reading it first.
+     */
+    v = COLOR_PAIR(x03);
+    for(p = 0; p < plane_num; p++) {
+        dst = status_buff + p*total_planesize/plane4 + cell*colnumber/plane4;
+        memcpy(dst, &v, sizeof(v));
+        for(row = 0; row < row_num; row++) {
+            dst += STATUS_ROW_BYTES;
+            m = room_g[row][p] | typed_g[row][p];
+            v = (COLOR_PAIR(x03) & ~m) | (COLOR_PAIR(c3) & m);
+            memcpy(dst, &v, sizeof(v));
+        }
+        v = COLOR_PAIR(x03);
+        memcpy(dst + STATUS_ROW_BYTES, &v, sizeof(v));
+    }
+    if(STATUS_CELLS - 1 == cell)
+        fix_status_dot();
 }
 
+
 /*
- * clear_status_bar
- *     DESCRIPTION: clear the status bar. 
- *     INPUTS:none 
- * 
+ * status_bar_invalidate
+ *     DESCRIPTION: Forgets what the status bar shows, so that the next
+ *                  draw_status_bar draws and copies all of it.  Call
+ *                  after anything else writes to the status bar in
+ *                  video memory.
+ *     INPUTS: None
  *     OUTPUTS: None
  *     RETURN VALUE: None
- *     SIDE EFFECTS: none
+ *     SIDE EFFECTS: None
  */
-void clear_status_bar() { // text_to_graphic(" ", CLEAR);
-    memset(status_buff, x03, total_planesize); 
-    //int i;
-    modex_helper();
-    /* for (i = 0; i < 4; i++) { 
-        SET_WRITE_MASK (1 << (i + 8));
-        memcpy(mem_image, status_buff + (i * 1440), 1440);  // 5760 / 4 = 1440
-    } */
-
-    return;
+void status_bar_invalidate() {
+    status_drawn = 0;
 }
 
+
 /*
- * write_user_input
- *     DESCRIPTION: write command onto the status bar. 
- *     INPUTS: *msg         -- The string written to the status bar 
- * 
+ * draw_status_bar
+ *     DESCRIPTION: Shows the status bar: the status message, centered,
+ *                  if there is one, and otherwise the room name on the
+ *                  left and the typed command on the right.  Only the
+ *                  parts that differ from the bar last shown are drawn
+ *                  and copied to video memory, so nothing is done if
+ *                  nothing has changed.
+ *     INPUTS: msg -- the status message, or NULL or "" for none
+ *             room -- the room name
+ *             typed -- the typed command
  *     OUTPUTS: None
  *     RETURN VALUE: None
- *     SIDE EFFECTS: none
+ *     SIDE EFFECTS: changes status_buff and the status bar in video memory
  */
-void write_user_input(const char* msg) {  // text_to_graphic(msg, TYPED_CMD);
-    populate_text_buff(msg, total320 - colnumber * strlen(msg)); 
-    //int i;
-    modex_helper();
-    /* for (i = 0; i < 4; i++) { 
-        SET_WRITE_MASK (1 << (i + 8));
-        memcpy(mem_image, status_buff + (i * 1440), 1440);  // 5760 / 4 = 1440
-    } */
+void draw_status_bar(const char* msg, const char* room, const char* typed) {
+    int len, start, cell, first, last, all;
+    char room_c, typed_c;
 
-    return;
-}
+    if(NULL != msg && '\0' != msg[0]) {
+        if(status_drawn && 0 == strncmp(msg, shown_msg, STATUS_CELLS))
+            return;
+        strncpy(shown_msg, msg, STATUS_CELLS);
+        shown_msg[STATUS_CELLS] = '\0';
+        memset(status_buff, x03, total_planesize);
+        populate_text_buff(shown_msg, (total320 - colnumber * strlen(shown_msg))/2); 
+        modex_helper();
+        status_drawn = 1;
+        return;
+    }
 
+    /*
+     * Coming back from a message(or drawing for the first time), every
+     * cell must be drawn.  Otherwise draw the cells from the first that
+     * changed to the last, and copy only their columns.
+     */
+    all = (!status_drawn || '\0' != shown_msg[0]);
+    shown_msg[0] = '\0';
+    status_drawn = 1;
 
+    /* The typed command ends at the right edge of the bar. */
+    len = strlen(room);
+    start = STATUS_CELLS - strlen(typed);
+    first = STATUS_CELLS;
+    last = -1;
+    for(cell = 0; cell < STATUS_CELLS; cell++) {
+        room_c = (cell < len ? room[cell] : '\0');
+        typed_c = (cell >= start ? typed[cell - start] : '\0');
+        if(!all && room_c == shown_room[cell] && typed_c == shown_typed[cell])
+            continue;
+        shown_room[cell] = room_c;
+        shown_typed[cell] = typed_c;
+        if(cell < first)
+            first = cell;
+        if(cell > last)
+            last = cell;
+    }
 
+    if(first > last)
+        return;
+    for(cell = first; cell <= last; cell++)
+        draw_status_cell(cell, shown_room[cell], shown_typed[cell]);
+    copy_status_cols(first * colnumber / plane4,
+                     (last - first + 1) * colnumber / plane4);
+}
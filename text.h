@@ -60,9 +60,7 @@
 /* Standard VGA text font. */
 extern unsigned char font_data[256][16];
 unsigned char status_buff[total_planesize];
-void write_room_name(const char* msg);
-void write_status_message(const char* msg);
-void clear_status_bar();
-void write_user_input(const char* msg);
+void draw_status_bar(const char* msg, const char* room, const char* typed);
+void status_bar_invalidate();
 
 #endif /* TEXT_H */
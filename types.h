@@ -37,9 +37,11 @@
 /* types defined in photo.c */
 typedef struct photo_t photo_t;
 typedef struct image_t image_t;
+typedef struct photo_ctx_t photo_ctx_t;
 
 /* types defined in world.h */
 typedef struct room_t room_t;
 typedef struct object_t object_t;
+typedef struct obj_span_t obj_span_t;
 
 #endif /* TYPES_H */
@@ -34,6 +34,8 @@
  */
 
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -170,9 +172,51 @@ enum {
     N_SWAPS
 };
 
+/*
+ * Room photos and object images are read from the asset pack
+ * ASSET_PACK_FILE(built with mp2photo -p) when it exists and holds
+ * them; any others are read from their own files.
+ */
+#ifndef ASSET_PACK_FILE
+#define ASSET_PACK_FILE "images/world.pack"
+#endif
+
+/*
+ * Room photos are decoded and quantized by a pool of PHOTO_LOAD_THREADS
+ * loader threads started by build_world, beginning with the starting
+ * room.  If DEFER_PHOTO_QUANTIZATION is defined, no loaders are started,
+ * and each photo is instead loaded the first time that its room is
+ * prepared for display(prep_room).
+ */
+#ifndef PHOTO_LOAD_THREADS
+#define PHOTO_LOAD_THREADS 4
+#endif
+
 
 /* types local to this file(declared in types.h) */
 
+/*
+ * An index of the objects in a room by row, so that drawing a row
+ * visits only the objects that cross it.  The spans of the objects are
+ * kept in drawing order(the order of the room's contents list), and
+ * the objects crossing row y are row_objs[row_start[y]] through
+ * row_objs[row_start[y + 1] - 1], also in drawing order.  Rows from
+ * n_rows on hold no objects.  The index is rebuilt by index_room_objects
+ * whenever objects are added to or taken out of the room; arrays grow
+ * as needed and are never shrunk.
+ */
+typedef struct obj_index_t obj_index_t;
+struct obj_index_t {
+    obj_span_t*        spans;      /* object spans in drawing order   */
+    const obj_span_t** row_objs;   /* spans crossing each row         */
+    uint32_t*          row_start;  /* first of row_objs for each row  */
+    int32_t            n_spans;    /* objects in room                 */
+    int32_t            n_rows;     /* rows down to the lowest object  */
+    int32_t            spans_cap;  /* entries allocated in spans      */
+    int32_t            objs_cap;   /* entries allocated in row_objs   */
+    int32_t            rows_cap;   /* entries allocated in row_start  */
+};
+
 /*
  * The structure representing a room in the world. The backpack/inventory
  * is also a 'room'(#0, R_INVENTORY).
@@ -184,6 +228,7 @@ struct room_t {
     room_t*     left;       /* room to the "left"             */
     room_t*     enter;      /* doors, etc.                    */
     room_t*     right;      /* room to the "right"            */
+    obj_index_t index;      /* object spans by row            */
 };
 
 /*
@@ -344,17 +389,24 @@ static const obj_data_t obj_data[N_OBJECTS] = {
  * image data for both photos once, but need an extra pointer in order to
  * keep track of the photo currently swapped out. We use these swap data
  * to name and describe these extra photos.
+ *
+ * If SHARE_SWAP_PALETTES is defined, each extra photo uses the palette of
+ * the room's own photo(see photo_share_palette): the extra photo is then
+ * decoded with a single table lookup per pixel, and swapping photos does
+ * not change the room's colors, at some cost in the extra photo's color
+ * quality.
  */
 typedef struct swap_data_t swap_data_t;
 struct swap_data_t {
     int32_t id;
     const char* const filename;
+    int32_t room;   /* room whose photo is swapped */
 };
 
 /* the swap photo descriptions */
 static const swap_data_t swap_data[N_SWAPS] = {
-    { SWAP_CIRCLE, "images/circlen2.photo"},   /* alternate for Boneyard */
-    { SWAP_CAR,    "images/caropen.photo" }    /* open/closed car photos */
+    { SWAP_CIRCLE, "images/circlen2.photo", R_CIRCLE_N },  /* alternate for Boneyard */
+    { SWAP_CAR,    "images/caropen.photo",  R_CAR_SITE }   /* open/closed car photos */
 };
 
 
@@ -363,11 +415,17 @@ static void do_photo_swap(room_t* r, int32_t which);
 static object_t* find_in_room(const room_t* r, const char* arg);
 static void insert_object_at(object_t* o, room_t* r, int32_t x, int32_t y);
 static void insert_object(object_t* o, room_t* r);
+static void index_room_objects(room_t* r);
+static void* grow_array(void* a, int32_t* cap, int32_t need, size_t size);
 static void move_object_to_inventory(object_t* obj);
 static object_t* obj_special_get(room_t* r, const char* arg);
 static int32_t player_flag_is_set(int32_t fnum);
 static void player_set_flag(int32_t fnum);
 static void remove_object(object_t* o);
+#ifndef DEFER_PHOTO_QUANTIZATION
+static void* photo_loader(void* ignore);
+#endif
+static void start_photo_loaders(void);
 
 
 /* file-scope variables */
@@ -381,6 +439,18 @@ static object_t object[N_OBJECTS];                   /* objects              */
 static uint32_t player_flags[(NUM_FLAGS + 31) / 32]; /* accomplishment flags */
 static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
 
+#ifndef DEFER_PHOTO_QUANTIZATION
+/*
+ * Photos waiting for the loader threads, in loading order.  The next
+ * photo to be claimed by a loader is at index load_next, which is
+ * protected by load_lock.
+ */
+static photo_t* load_queue[N_ROOMS + N_SWAPS];       /* photos to load       */
+static int32_t  load_count;                          /* photos in queue      */
+static int32_t  load_next;                           /* next photo to load   */
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 
 /*
  * do_photo_swap
@@ -452,6 +522,7 @@ static void insert_object_at(object_t* o, room_t* r, int32_t x, int32_t y) {
     o->loc = r;
     o->next = r->contents;
     r->contents = o;
+    index_room_objects(r);
 }
 
 
@@ -625,12 +696,118 @@ static void remove_object(object_t* o) {
             }
         }
 
-        /* Mark the object's location as NULL. */
+        /* Reindex the room, then mark the object's location as NULL. */
+        index_room_objects(o->loc);
         o->loc = NULL;
     }
 }
 
 
+/*
+ * index_room_objects
+ *   DESCRIPTION: Rebuild the index of a room's objects by row(see
+ *                obj_index_t) after its contents have changed.
+ *   INPUTS: r -- the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may allocate memory for the index; panics if memory
+ *                 runs out
+ */
+static void index_room_objects(room_t* r) {
+    obj_index_t* idx = &r->index; /* the room's index             */
+    object_t*    o;               /* index over room contents     */
+    obj_span_t*  s;               /* span of current object       */
+    int32_t      n;               /* number of objects            */
+    int32_t      rows;            /* rows down to lowest object   */
+    int32_t      total;           /* total entries over all rows  */
+    int32_t      y;               /* index over rows              */
+
+    /* Count the objects, the rows, and the row entries needed. */
+    n = rows = total = 0;
+    for (o = r->contents; NULL != o; o = o->next) {
+        n++;
+        if (rows < o->y + (int32_t)image_height(o->img)) {
+            rows = o->y + image_height(o->img);
+        }
+        total += image_height(o->img);
+    }
+    if (NULL == (idx->spans = grow_array(idx->spans, &idx->spans_cap, n,
+                                         sizeof (idx->spans[0]))) ||
+        NULL == (idx->row_objs = grow_array(idx->row_objs, &idx->objs_cap,
+                                            total, sizeof (idx->row_objs[0]))) ||
+        NULL == (idx->row_start = grow_array(idx->row_start, &idx->rows_cap,
+                                             rows + 1, sizeof (idx->row_start[0])))) {
+        PANIC("out of memory for room object index");
+    }
+
+    /* Cache the spans, in drawing order. */
+    for (o = r->contents, s = idx->spans; NULL != o; o = o->next, s++) {
+        s->x = o->x;
+        s->y = o->y;
+        s->w = image_width(o->img);
+        s->h = image_height(o->img);
+        s->img = o->img;
+    }
+    idx->n_spans = n;
+    idx->n_rows = rows;
+
+    /*
+     * Count the objects crossing each row(in row_start[y + 1]) and turn
+     * the counts into starting positions, then place the objects, using
+     * row_start[y] as the next position for row y.  Placing them moves
+     * each row's start up by one row, so shift the starts back down.
+     */
+    (void)memset(idx->row_start, 0, (rows + 1) * sizeof (idx->row_start[0]));
+    for (s = idx->spans; idx->spans + n > s; s++) {
+        for (y = s->y; s->y + s->h > y; y++) {
+            idx->row_start[y + 1]++;
+        }
+    }
+    for (y = 0; rows > y; y++) {
+        idx->row_start[y + 1] += idx->row_start[y];
+    }
+    for (s = idx->spans; idx->spans + n > s; s++) {
+        for (y = s->y; s->y + s->h > y; y++) {
+            idx->row_objs[idx->row_start[y]++] = s;
+        }
+    }
+    (void)memmove(idx->row_start + 1, idx->row_start,
+                  rows * sizeof (idx->row_start[0]));
+    idx->row_start[0] = 0;
+}
+
+
+/*
+ * grow_array
+ *   DESCRIPTION: Make sure that a dynamically allocated array has room
+ *                for a number of entries, reallocating it if necessary.
+ *   INPUTS: a -- the array(NULL if not yet allocated)
+ *           cap -- entries allocated in the array
+ *           need -- entries needed
+ *           size -- size of an entry in bytes
+ *   OUTPUTS: cap -- entries allocated after growing
+ *   RETURN VALUE: the array(possibly moved), or NULL on failure(in
+ *                 which case the old array is freed)
+ *   SIDE EFFECTS: may allocate memory
+ */
+static void* grow_array(void* a, int32_t* cap, int32_t need, size_t size) {
+    void* grown; /* array after reallocation */
+
+    if (NULL != a && *cap >= need) {
+        return a;
+    }
+    if (need < 2 * *cap) {
+        need = 2 * *cap;
+    }
+    if (NULL == (grown = realloc(a, (need > 0 ? need : 1) * size))) {
+        free(a);
+        return NULL;
+    }
+    *cap = need;
+    return grown;
+}
+
+
 /*
  * obj_get_x
  *   DESCRIPTION: Get x position of object within containing room.
@@ -699,6 +876,46 @@ object_t* room_contents_iterate(const room_t* r) {
 }
 
 
+/*
+ * room_object_spans
+ *   DESCRIPTION: Get the spans(position, size, and image) of the objects
+ *                in a room, in the order in which they are drawn.
+ *   INPUTS: r -- pointer to the room
+ *   OUTPUTS: spans -- the spans(valid until the room's contents change)
+ *   RETURN VALUE: the number of objects in room r
+ *   SIDE EFFECTS: none
+ */
+int32_t room_object_spans(const room_t* r, const obj_span_t** spans) {
+    *spans = r->index.spans;
+    return r->index.n_spans;
+}
+
+
+/*
+ * room_row_objects
+ *   DESCRIPTION: Get the spans of the objects in a room that cross one
+ *                row of the room photo, in the order in which they are
+ *                drawn.
+ *   INPUTS: r -- pointer to the room
+ *           y -- the row
+ *   OUTPUTS: row -- pointers to the spans(valid until the room's
+ *                   contents change)
+ *   RETURN VALUE: the number of objects crossing row y
+ *   SIDE EFFECTS: none
+ */
+int32_t room_row_objects(const room_t* r, int32_t y,
+                         const obj_span_t* const** row) {
+    const obj_index_t* idx = &r->index; /* the room's index */
+
+    if (0 > y || idx->n_rows <= y) {
+        *row = NULL;
+        return 0;
+    }
+    *row = idx->row_objs + idx->row_start[y];
+    return idx->row_start[y + 1] - idx->row_start[y];
+}
+
+
 /*
  * room_name
  *   DESCRIPTION: Get name for a room.
@@ -753,9 +970,10 @@ uint32_t room_photo_width(const room_t* r) {
 
 /*
  * build_world
- *   DESCRIPTION: Builds and connects the rooms, creates objects, and
- *                reads in all image data(could be done lazily with
- *                caching instead).
+ *   DESCRIPTION: Builds and connects the rooms, creates objects, reads
+ *                in all object images and room photo headers(from the
+ *                asset pack where possible), and starts loading the
+ *                room photos in the background(see start_photo_loaders).
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: 1 on success, or 0 on failure
@@ -768,6 +986,9 @@ int32_t build_world() {
     /* Clear all accomplishment flags. */
     (void)memset(player_flags, 0, sizeof (player_flags));
 
+    /* Map the asset pack, if any(files are read one by one otherwise). */
+    (void)open_asset_pack(ASSET_PACK_FILE);
+
     /* Clear room data to enable sanity check for duplication. */
     (void)memset(room, 0, sizeof (room));
 
@@ -789,7 +1010,7 @@ int32_t build_world() {
 
         /* Set up the room. */
         room[which].name = room_data[idx].name;
-        room[which].view = read_photo(room_data[idx].filename);
+        room[which].view = open_photo(room_data[idx].filename);
         if (NULL == room[which].view) {
             fprintf(stderr, "Can't read room photo %s.\n", room_data[idx].filename);
             return 0;
@@ -861,19 +1082,102 @@ int32_t build_world() {
             return 0;
         }
 
-        /* Read in the swap photo. */
-        swap_photo[which] = read_photo(swap_data[idx].filename);
+        /* Open the swap photo. */
+        swap_photo[which] = open_photo(swap_data[idx].filename);
         if (NULL == swap_photo[which]) {
             fprintf(stderr, "Can't read room photo %s.\n", swap_data[idx].filename);
             return 0;
         }
+#ifdef SHARE_SWAP_PALETTES
+        photo_share_palette(swap_photo[which], room[swap_data[idx].room].view);
+#endif
     }
 
+    /* Start decoding the photos in the background. */
+    start_photo_loaders();
+
     /* Everything worked! */
     return 1;
 }
 
 
+#ifndef DEFER_PHOTO_QUANTIZATION
+
+/*
+ * photo_loader
+ *   DESCRIPTION: Function executed by photo loader threads.  Claims photos
+ *                from the load queue one at a time and loads them until
+ *                the queue is empty.  A photo already being loaded(by
+ *                prep_room, for example) is simply waited for.
+ *   INPUTS: none(ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: loads room photos; prints error messages to stderr
+ */
+static void* photo_loader(void* ignore) {
+    photo_t*     p;   /* photo claimed from the queue               */
+    photo_ctx_t* ctx; /* this thread's decoding context(or NULL) */
+
+    /* Without a context of its own, the thread shares the default one. */
+    ctx = photo_ctx_create();
+    while (1) {
+        (void)pthread_mutex_lock(&load_lock);
+        p = (load_count > load_next ? load_queue[load_next++] : NULL);
+        (void)pthread_mutex_unlock(&load_lock);
+        if (NULL == p) {
+            photo_ctx_destroy(ctx);
+            return NULL;
+        }
+        if (0 != load_photo(p, ctx)) {
+            fputs("Can't load a room photo.\n", stderr);
+        }
+    }
+}
+
+#endif /* !defined(DEFER_PHOTO_QUANTIZATION) */
+
+
+/*
+ * start_photo_loaders
+ *   DESCRIPTION: Queue all room and swap photos for loading, starting
+ *                with the photo for the starting room, and start the
+ *                loader threads.  Does nothing if DEFER_PHOTO_QUANTIZATION
+ *                is defined.  If threads cannot be created, photos are
+ *                loaded by prep_room as they are needed.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: creates detached threads
+ */
+static void start_photo_loaders() {
+#ifndef DEFER_PHOTO_QUANTIZATION
+    pthread_t      id;   /* id of new loader thread */
+    pthread_attr_t attr; /* attributes of loaders   */
+    int32_t        idx;  /* index over photos       */
+
+    load_count = load_next = 0;
+    load_queue[load_count++] = start_in_room()->view;
+    for (idx = 0; N_ROOMS > idx; idx++) {
+        if (start_in_room() != &room[idx]) {
+            load_queue[load_count++] = room[idx].view;
+        }
+    }
+    for (idx = 0; N_SWAPS > idx; idx++) {
+        load_queue[load_count++] = swap_photo[idx];
+    }
+
+    (void)pthread_attr_init(&attr);
+    (void)pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (idx = 0; PHOTO_LOAD_THREADS > idx; idx++) {
+        if (0 != pthread_create(&id, &attr, photo_loader, NULL)) {
+            break;
+        }
+    }
+    (void)pthread_attr_destroy(&attr);
+#endif /* !defined(DEFER_PHOTO_QUANTIZATION) */
+}
+
+
 /*
  * start_in_room
  *   DESCRIPTION: Get a pointer to the room in which the player begins
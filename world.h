@@ -39,12 +39,31 @@
 #include "types.h"
 
 
+/*
+ * The span of an object drawn in a room: its position, size, and image,
+ * as cached in the room's object index(see room_row_objects).  Spans
+ * change only when objects are added to or taken out of the room.
+ */
+struct obj_span_t {
+    int32_t        x, y;    /* position within room photo  */
+    int32_t        w, h;    /* image width and height      */
+    const image_t* img;     /* image for use in room       */
+};
+
+
 /* structure access functions */
 extern uint16_t obj_get_x(const object_t* obj);
 extern uint16_t obj_get_y(const object_t* obj);
 extern image_t* obj_image(const object_t* obj);
 extern object_t* obj_next(const object_t* obj);
 extern object_t* room_contents_iterate(const room_t* r);
+
+/* Get spans of all objects in a room, in drawing order. */
+extern int32_t room_object_spans(const room_t* r, const obj_span_t** spans);
+
+/* Get spans of the objects that cross one row of a room, in drawing order. */
+extern int32_t room_row_objects(const room_t* r, int32_t y,
+                                const obj_span_t* const** row);
 extern const char* room_name(const room_t* r);
 extern photo_t* room_photo(const room_t* r);
 extern uint32_t room_photo_height(const room_t* r);